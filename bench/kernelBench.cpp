@@ -0,0 +1,834 @@
+// Micro benchmarks of the analysis kernels and of the output path on synthetic frames.
+// Results are written as JSON so that two runs (e.g. before and after a kernel change) can be compared.
+//
+//   MultiCamSwitchBench [--out bench.json] [--min-time <ms>] [--simd scalar|sse41|avx2] [--check] [--video <file>]
+//
+// The fused kernels are compared with the OpenCV chains they replace on every SIMD path, the bench fails (exit
+// code 1) if one is further than its bound (the background model must match the scalar code frame after frame,
+// accumulators included), or if the blobs are further from findContours/contourArea/moments than
+// BLOB_AREA_TOLERANCE and BLOB_CENTROID_TOLERANCE. It also fails if a scoring method gives different blobs or scores
+// when the analysis is split in stripes, or if the motion gate changes the mask when every tile changed or loses more
+// of it than the skipped tiles allow (on the synthetic video and on the --video footage, if given).
+// --check runs only the checks, without the timings (ctest).
+// Built with MULTICAMSWITCH_ALLOC_COUNTING it also runs the capture steps of every scoring method on a longer
+// synthetic video and fails (exit code 1) if a step allocates once the warm up is over. The ctest
+// steady_state_allocations runs it as MultiCamSwitchAllocCheck when the main build has the option off.
+
+#include "scene.h"
+#include "capture.h"
+#include "simdDispatch.h"
+#include "backgroundModel.h"
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define SYNTHETIC_FRAMES 8 // frames of each synthetic sequence, the benchmarks cycle over them
+#define WARMUP_ITERATIONS 5
+#define MIN_ITERATIONS 20
+#define ALLOC_CHECK_LOOPS 8 // the allocation check runs on the synthetic sequence repeated ALLOC_CHECK_LOOPS times
+#define ALLOC_CHECK_STRIPES 4
+#define BACKGROUND_CHECK_FRAMES 600 // frames learned by the background model check, enough for the accumulators to drift
+#define BLOB_AREA_TOLERANCE 0.01 // relative difference of the total area from contourArea, only holes make one
+#define BLOB_CENTROID_TOLERANCE 1.0 // pixels between the centroid of the pixels and the one of the contour polygon
+#define STRIPE_CHECK_STRIPES 4 // the stripe check compares 1 stripe with STRIPE_CHECK_STRIPES
+#define STRIPE_CHECK_GATE 2 // motion gate threshold of the gated runs of the stripe check
+#define GATE_CHECK_THRESHOLD 2 // motion gate threshold of the gate check, the motionGate of scene.conf
+#define GATE_CHECK_FRAMES 300 // frames of a video compared by the gate check
+
+struct BenchResult{
+    std::string name;
+    cv::Size size;
+    std::vector<double> samples; // ms
+    double checksum; // sum of a value computed by every iteration, changes if the results change
+    std::string note;
+};
+
+// Heap allocations of the capture steps after ALLOC_WARMUP_FRAMES
+struct AllocationResult{
+    std::string method;
+    cv::Size size;
+    int stripes;
+    unsigned long long frames;
+    unsigned long long allocations; // by our code, must be 0
+    unsigned long long allocatingFrames;
+    unsigned long long foreign; // by the decoder and OpenCV
+};
+
+// Blobs of the extractor against findContours (external contours), contourArea and moments on the same masks
+struct ContourCheck{
+    cv::Size size;
+    int frames;
+    int blobs, contours;
+    int unmatched; // contours without a blob with the same bounding box
+    double maxAreaDiff; // largest |polygonArea - contourArea| of a blob
+    double totalAreaRelDiff; // |sum of totalArea - sum of the contour areas >= MIN_BLOB_AREA|/the latter, over the frames
+    double maxCentroidDist; // pixels
+};
+
+// A scoring method run with 1 and STRIPE_CHECK_STRIPES stripes on the same video: the blobs and the scores must be identical
+struct StripeCheck{
+    std::string method;
+    cv::Size size;
+    double gate; // motion gate threshold, 0 = off
+    unsigned long long frames;
+    unsigned long long differingFrames;
+    int firstDifference; // index of the first frame that differs, -1 if none
+};
+
+// FrameDiffAreaAndVel on the same video with incremental tracking and with Lucas-Kanade on every blob
+struct FlowComparison{
+    cv::Size size;
+    unsigned long long frames; // with blobs in both runs
+    unsigned long long lkPointsIncremental, lkPointsFull;
+    unsigned long long trackedPoints; // Lucas-Kanade points saved by the incremental run
+    double meanSpeedIncremental, meanSpeedFull;
+    double meanSpeedDiff; // mean of |incremental - full| over the frames
+    double maxScoreRelDiff; // largest |incremental - full|/full score
+};
+
+// Motion masks with and without the motion gate on consecutive frames. The gate only drops the differences of the
+// tiles under its threshold: the gated mask must be inside the ungated one, and equal to it when every tile changed
+struct GateCheck{
+    std::string source; // "noise" (every tile changed), "synthetic" or the path of a video
+    cv::Size size; // of the analyzed frames
+    double threshold;
+    unsigned long long frames;
+    unsigned long long tiles, skippedTiles;
+    unsigned long long maskPixels; // set in the ungated masks
+    unsigned long long extraPixels; // set only in the gated masks, must be 0
+    unsigned long long lostPixels; // set only in the ungated masks
+    unsigned long long lostBound; // largest lostPixels the skipped tiles allow
+};
+
+struct AccuracyResult{
+    std::string name;
+    cv::Size size;
+    SimdLevel simd; // code path of the kernel
+    int maxAbsDiff;
+    double differingPixels; // fraction
+    int bound; // largest maxAbsDiff allowed, 0 = identical
+};
+
+class KernelBench{
+private:
+    double minTimeMs;
+    bool checksOnly; // no timings
+    std::vector<cv::Size> sizes;
+    std::filesystem::path workDir;
+    std::vector<BenchResult> results;
+    std::vector<AccuracyResult> accuracy;
+    std::vector<AllocationResult> allocations;
+    std::vector<FlowComparison> flowComparisons;
+    std::vector<StripeCheck> stripeChecks;
+    std::vector<ContourCheck> contourChecks;
+    std::vector<GateCheck> gateChecks;
+    std::string gateVideo; // real footage for the gate check, optional
+
+    template<typename F>
+    void measure(const std::string& name, const cv::Size size, F body, const std::string& note = ""){
+        for(int i = 0; i < WARMUP_ITERATIONS; i++) body(i);
+        BenchResult r{name, size, {}, 0, note};
+        double elapsed = 0;
+        for(int i = 0; r.samples.size() < MIN_ITERATIONS || elapsed < minTimeMs; i++){
+            auto start = std::chrono::steady_clock::now();
+            r.checksum += body(i);
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            r.samples.push_back(ms);
+            elapsed += ms;
+        }
+        std::cout << "  " << name << " " << size.width << "x" << size.height << ": " << std::fixed << std::setprecision(4)
+                  << mean(r.samples) << " ms (" << r.samples.size() << " iterations)" << std::endl;
+        results.push_back(r);
+    }
+
+    static double mean(const std::vector<double>& v){
+        double sum = 0;
+        for(double x : v) sum += x;
+        return v.empty() ? 0 : sum/v.size();
+    }
+
+    static double percentile(std::vector<double> v, const double p){
+        if(v.empty()) return 0;
+        std::sort(v.begin(), v.end());
+        return v[std::min(v.size() - 1, (size_t)std::floor(p*(v.size() - 1) + 0.5))];
+    }
+
+    // Textured background with a few "players" (ellipses) moving between the frames
+    static std::vector<cv::Mat> syntheticFrames(const cv::Size size){
+        std::vector<cv::Mat> frames;
+        cv::RNG rng(12345);
+        cv::Mat background(size, CV_8UC3);
+        rng.fill(background, cv::RNG::UNIFORM, cv::Scalar(40, 90, 40), cv::Scalar(70, 140, 70));
+        cv::GaussianBlur(background, background, cv::Size(7, 7), 2);
+        const int players = 12;
+        const double scale = size.width/640.0;
+        for(int t = 0; t < SYNTHETIC_FRAMES; t++){
+            cv::Mat f = background.clone();
+            for(int p = 0; p < players; p++){
+                cv::Point center((int)((60 + 45*p + 6*t*(p%3 + 1))*scale) % size.width, (int)((40 + 23*p + 4*t*(p%2 ? 1 : -1) + size.height) % size.height));
+                cv::ellipse(f, center, cv::Size((int)(6*scale) + 1, (int)(14*scale) + 1), 0, 0, 360, cv::Scalar(30*p % 255, 200, 255 - 20*p), -1);
+            }
+            frames.push_back(f);
+        }
+        return frames;
+    }
+
+    std::string writeVideo(const cv::Size size, const std::vector<cv::Mat>& frames, const int loops = 1){
+        std::string path = (workDir / ("synthetic_" + std::to_string(size.width) + "x" + std::to_string(size.height) + "_" + std::to_string(loops*frames.size()) + ".avi")).string();
+        cv::VideoWriter w(path, cv::VideoWriter::fourcc('M','J','P','G'), 25, size);
+        if(!w.isOpened()) throw std::runtime_error("Unable to write the synthetic video " + path);
+        for(int i = 0; i < loops; i++) for(const auto& f : frames) w.write(f);
+        return path;
+    }
+
+    std::string writeConfig(const std::vector<std::string>& videos){
+        std::string path = (workDir / "bench.conf").string();
+        std::ofstream conf(path);
+        conf << "[CAM_TO_ANALYZE]\n";
+        for(int i = 0; i < videos.size(); i++) conf << "Cam" << i << "=" << videos[i] << "\n";
+        conf << "[CAM_TO_SHOW]\n";
+        for(int i = 0; i < videos.size(); i++) conf << "Cam" << i << "=" << videos[i] << "\n";
+        conf << "[ASSOCIATIONS]\n";
+        for(int i = 0; i < videos.size(); i++) conf << "Cam" << i << "=Cam" << i << "\n";
+        conf << "[OUT]\nwidth=640\nheight=360\noutPath=" << (workDir / "out.avi").string() << "\n";
+        conf << "[GENERAL]\nmethod=FrameDiffAreaAndVel\ndisplayOutput=false\ndisplayAllCaptures=false\n";
+        return path;
+    }
+
+    // Distance of the fused kernels from the OpenCV chains they replace, on every code path the CPU supports
+    void checkAccuracy(Capture& cap, const cv::Size size, const std::vector<cv::Mat>& frames){
+        const int levelCap = simdLevelCap;
+        for(int level = SIMD_SCALAR; level <= std::min((int)detectSimdLevel(), levelCap); level++){
+            simdLevelCap = level;
+            checkAccuracy(cap, size, frames, (SimdLevel)level);
+        }
+        simdLevelCap = levelCap;
+    }
+
+    void checkAccuracy(Capture& cap, const cv::Size size, const std::vector<cv::Mat>& frames, const SimdLevel level){
+        cv::Mat fused, resized, reference;
+        cap.preProcessing(frames[0], &fused);
+        cv::resize(frames[0], resized, fused.size());
+        cv::cvtColor(resized, reference, cv::COLOR_BGR2GRAY);
+        cv::GaussianBlur(reference, reference, cv::Size(5,5), 0.3);
+        cv::Mat diff;
+        cv::absdiff(fused, reference, diff);
+        double maxVal;
+        cv::minMaxLoc(diff, nullptr, &maxVal);
+        accuracy.push_back({"preProcessing", size, level, (int)maxVal, cv::countNonZero(diff)/(double)diff.total(), PREPROCESS_MAX_ERROR});
+
+        cv::Mat prev, curr, mask;
+        cap.preProcessing(frames[0], &prev);
+        cap.preProcessing(frames[1], &curr);
+        BinaryMask bits;
+        cap.frameDifferencing(&bits, &prev, &curr);
+        bits.toMat(mask);
+        cv::absdiff(prev, curr, reference);
+        cv::threshold(reference, reference, 20, 255, cv::THRESH_BINARY);
+        cv::dilate(reference, reference, cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(2*DILATE_SIZE + 1, 2*DILATE_SIZE + 1)));
+        cv::absdiff(mask, reference, diff);
+        cv::minMaxLoc(diff, nullptr, &maxVal);
+        accuracy.push_back({"frameDifferencing", size, level, (int)maxVal, cv::countNonZero(diff)/(double)diff.total(), 0}); // the same mask, bit for bit
+
+        if(level > SIMD_SCALAR){
+            for(const int shift : {BACKGROUND_SHIFT, 1}) checkBackgroundModel(cap, size, frames, level, shift);
+        }
+    }
+
+    // The background model of a code path against the scalar one, frame after frame: the masks and the fixed point
+    // accumulators must stay identical, so that a rounding difference cannot build up over a long video
+    void checkBackgroundModel(Capture& cap, const cv::Size size, const std::vector<cv::Mat>& frames, const SimdLevel level, const int shift){
+        std::vector<cv::Mat> grays(frames.size());
+        for(int i = 0; i < frames.size(); i++) cap.preProcessing(frames[i], &grays[i]);
+        BackgroundModel reference, model;
+        reference.setShift(shift);
+        model.setShift(shift);
+        BinaryMask referenceMask, mask;
+        int maxDiff = 0;
+        unsigned long long differing = 0, total = 0;
+        cv::Mat gray;
+        for(int t = 0; t < BACKGROUND_CHECK_FRAMES; t++){
+            // The players move over a background whose brightness swings, with a black and a white frame now and then
+            // to saturate the accumulators
+            if(t % 97 == 50) gray = cv::Mat::zeros(grays[0].size(), CV_8UC1);
+            else if(t % 97 == 51) gray = cv::Mat(grays[0].size(), CV_8UC1, cv::Scalar(255));
+            else grays[t % grays.size()].convertTo(gray, -1, 1, std::round(80*std::sin(t*0.07)));
+            simdLevelCap = SIMD_SCALAR;
+            reference.run(gray, 20, referenceMask);
+            simdLevelCap = level;
+            model.run(gray, 20, mask);
+            for(int y = 0; y < mask.rows; y++){
+                for(int w = 0; w < mask.wordsPerRow; w++){
+                    const uint64_t valid = w + 1 < mask.wordsPerRow ? ~(uint64_t)0 : mask.lastWordMask();
+                    differing += __builtin_popcountll((mask.row(y)[w] ^ referenceMask.row(y)[w]) & valid);
+                }
+            }
+            for(int i = 0; i < model.background.size(); i++){
+                const int d = std::abs((int)model.background[i] - (int)reference.background[i]);
+                maxDiff = std::max(maxDiff, d);
+                if(d) differing++;
+            }
+            total += 2*model.background.size(); // a mask bit and an accumulator per pixel
+        }
+        accuracy.push_back({"backgroundModel shift " + std::to_string(shift), size, level, maxDiff, differing/(double)total, 0}); // bit for bit, accumulators included
+    }
+
+    // The blob areas keep the contourArea semantics of the contours they replace: exact for the blobs without holes
+    void checkBlobs(Capture& cap, const cv::Size size, const std::vector<cv::Mat>& frames){
+        std::vector<cv::Mat> grays(frames.size());
+        for(int i = 0; i < frames.size(); i++) cap.preProcessing(frames[i], &grays[i]);
+        ContourCheck r{size, (int)frames.size(), 0, 0, 0, 0, 0, 0};
+        double blobTotal = 0, contourTotal = 0;
+        for(int i = 0; i < frames.size(); i++){
+            BinaryMask mask;
+            BlobStats blobs;
+            cap.frameDifferencing(&mask, &grays[i], &grays[(i + 1) % grays.size()]);
+            cap.blobExtractor.run(mask, MIN_BLOB_AREA, blobs);
+            cv::Mat image;
+            mask.toMat(image);
+            std::vector<std::vector<cv::Point>> contours;
+            cv::findContours(image, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+            r.blobs += blobs.size();
+            r.contours += contours.size();
+            blobTotal += blobs.totalArea;
+            for(const auto& contour : contours){
+                const double area = cv::contourArea(contour);
+                if(area >= MIN_BLOB_AREA) contourTotal += area;
+                const cv::Rect box = cv::boundingRect(contour);
+                int b = 0;
+                while(b < blobs.size() && blobs.box[b] != box) b++;
+                if(b == blobs.size()){
+                    r.unmatched++;
+                    continue;
+                }
+                r.maxAreaDiff = std::max(r.maxAreaDiff, std::abs(blobs.polygonArea[b] - area));
+                const cv::Moments m = cv::moments(contour);
+                if(m.m00 <= 0) continue; // a line, no centroid
+                const cv::Point2f diff = blobs.centroid[b] - cv::Point2f(m.m10/m.m00, m.m01/m.m00);
+                r.maxCentroidDist = std::max(r.maxCentroidDist, (double)std::sqrt(diff.x*diff.x + diff.y*diff.y));
+            }
+        }
+        r.totalAreaRelDiff = contourTotal > 0 ? std::abs(blobTotal - contourTotal)/contourTotal : blobTotal > 0;
+        std::cout << "  blobs against contours: " << r.blobs << "/" << r.contours << ", total area difference " << std::setprecision(3)
+                  << 100*r.totalAreaRelDiff << "%, centroids within " << r.maxCentroidDist << " px" << std::endl;
+        contourChecks.push_back(r);
+    }
+
+    // Gated and ungated masks of two preprocessed frames through the capture code (gateFrame and frameDifferencing).
+    // A skipped tile has at most threshold*area/21 differences above 20, each one dilated by the ellipse: that many
+    // pixels times the kernel area is what the gate can lose.
+    static void compareGate(Capture& cap, GateCheck& r, const cv::Mat& prev, const cv::Mat& curr){
+        static const int kernelArea = cv::countNonZero(cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(2*DILATE_SIZE + 1, 2*DILATE_SIZE + 1)));
+        BinaryMask ungated, gated;
+        cap.previousFrame = prev;
+        cap.croppedFrame = curr;
+        const double gateThreshold = Capture::gateThreshold;
+        Capture::gateThreshold = 0;
+        cap.frameDifferencing(&ungated, &cap.previousFrame, &cap.croppedFrame);
+        Capture::gateThreshold = r.threshold;
+        if(cap.gateFrame()) cap.frameDifferencing(&gated, &cap.previousFrame, &cap.croppedFrame);
+        else gated = cap.motionMask;
+        Capture::gateThreshold = gateThreshold;
+        const int skipped = cap.motionGate.tileCount() - cap.motionGate.changedTiles();
+        r.frames++;
+        r.tiles += cap.motionGate.tileCount();
+        r.skippedTiles += skipped;
+        r.lostBound += (unsigned long long)skipped*kernelArea*(unsigned long long)std::floor(r.threshold*GATE_TILE*GATE_TILE/21);
+        for(int y = 0; y < ungated.rows; y++){
+            for(int w = 0; w < ungated.wordsPerRow; w++){
+                const uint64_t valid = w + 1 < ungated.wordsPerRow ? ~(uint64_t)0 : ungated.lastWordMask();
+                const uint64_t a = ungated.row(y)[w] & valid, b = gated.row(y)[w] & valid;
+                r.maskPixels += __builtin_popcountll(a);
+                r.extraPixels += __builtin_popcountll(b & ~a);
+                r.lostPixels += __builtin_popcountll(a & ~b);
+            }
+        }
+    }
+
+    // Every tile above the threshold: consecutive frames with noise of 30 to 60 gray levels added, the masks must be equal
+    void checkGateChanged(Capture& cap, const cv::Size size, const std::vector<cv::Mat>& frames){
+        cv::RNG rng(54321);
+        GateCheck r{"noise", size, GATE_CHECK_THRESHOLD, 0, 0, 0, 0, 0, 0, 0};
+        cv::Mat prev, curr, noise;
+        for(int i = 0; i < frames.size(); i++){
+            cap.preProcessing(frames[i], &prev);
+            noise.create(prev.size(), CV_8UC1);
+            rng.fill(noise, cv::RNG::UNIFORM, 30, 61);
+            cv::add(prev, noise, curr);
+            r.size = prev.size();
+            compareGate(cap, r, prev, curr);
+        }
+        printGateCheck(r);
+        gateChecks.push_back(r);
+    }
+
+    // Consecutive frames of a video (the decoded synthetic one, or real footage) with the default threshold:
+    // the gated mask may lose the motion of the skipped tiles, within lostBound
+    void checkGateVideo(const std::string& source, const std::string& path){
+        Capture cap("GateCheck", path, true);
+        cap.openSource();
+        GateCheck r{source, cv::Size(), GATE_CHECK_THRESHOLD, 0, 0, 0, 0, 0, 0, 0};
+        cv::Mat frame, prev, curr;
+        for(int i = 0; i < GATE_CHECK_FRAMES && cap.read(frame); i++){
+            cap.preProcessing(frame, &curr);
+            r.size = curr.size();
+            if(!prev.empty()) compareGate(cap, r, prev, curr);
+            std::swap(prev, curr);
+        }
+        printGateCheck(r);
+        gateChecks.push_back(r);
+    }
+
+    static void printGateCheck(const GateCheck& r){
+        std::cout << "  gate " << r.source << " (threshold " << r.threshold << "): " << r.skippedTiles << " of " << r.tiles
+                  << " tiles skipped, " << r.lostPixels << " of " << r.maskPixels << " mask pixels lost (bound " << r.lostBound
+                  << "), " << r.extraPixels << " added" << std::endl;
+    }
+
+    void benchCapture(Capture& cap, const cv::Size size, const std::vector<cv::Mat>& frames){
+        std::vector<cv::Mat> grays(frames.size());
+        for(int i = 0; i < frames.size(); i++) cap.preProcessing(frames[i], &grays[i]);
+        std::vector<BinaryMask> masks(frames.size());
+        std::vector<BlobStats> blobs(frames.size());
+        for(int i = 0; i < frames.size(); i++){
+            cap.frameDifferencing(&masks[i], &grays[i], &grays[(i + 1) % frames.size()]);
+            cap.blobExtractor.run(masks[i], MIN_BLOB_AREA, blobs[i]);
+        }
+
+        cv::Mat gray;
+        measure("preProcessing", size, [&](const int i) {
+            cap.preProcessing(frames[i % frames.size()], &gray);
+            return (double)gray.at<uchar>(gray.rows/2, gray.cols/2);
+        });
+        BinaryMask mask;
+        measure("frameDifferencing", size, [&](const int i) {
+            cap.frameDifferencing(&mask, &grays[i % grays.size()], &grays[(i + 1) % grays.size()]);
+            double set = 0;
+            for(uint64_t w : mask.bits) set += __builtin_popcountll(w);
+            return set;
+        });
+        BinaryMask foreground;
+        measure("backgroundSubtraction", size, [&](const int i) {
+            cap.backgroundSubtraction(&foreground, grays[i % grays.size()]);
+            double set = 0;
+            for(uint64_t w : foreground.bits) set += __builtin_popcountll(w);
+            return set;
+        }, "running average update and dilation (BackgroundModelArea)");
+        MotionGate gate;
+        measure("motionGate", size, [&](const int i) {
+            return (double)gate.run(grays[i % grays.size()], grays[(i + 1) % grays.size()], 2);
+        }, "block SAD, threshold 2");
+        measure("getArea", size, [&](const int i) {
+            cap.blobExtractor.run(masks[i % masks.size()], MIN_BLOB_AREA, cap.blobs);
+            return cap.getArea(cap.blobs);
+        }, "includes the blob extraction");
+        measure("getAvgSpeed", size, [&](const int i) {
+            const int j = i % (grays.size() - 1);
+            double vel = cap.getAvgSpeed(grays[j + 1], grays[j], blobs[j]);
+            cap.flowTracker.nextFrame();
+            return vel;
+        }, "consecutive frames, with blob tracking");
+        cap.flowTracker.setIncremental(false);
+        measure("getAvgSpeedFullLK", size, [&](const int i) {
+            const int j = i % (grays.size() - 1);
+            double vel = cap.getAvgSpeed(grays[j + 1], grays[j], blobs[j]);
+            cap.flowTracker.nextFrame();
+            return vel;
+        }, "consecutive frames, Lucas-Kanade on every blob");
+        cap.flowTracker.setIncremental(true);
+    }
+
+    void benchScene(Scene& scene, const int capNum, const cv::Size size, const std::vector<cv::Mat>& frames){
+        int fps = 25;
+        measure("outputFrame", size, [&](const int i) {
+            cv::Mat f = frames[i % frames.size()];
+            scene.outputFrame(&f, fps, std::chrono::steady_clock::time_point());
+            return (double)scene.lastOutput.at<cv::Vec3b>(0, 0)[0];
+        }, "crop and resize into the encoder buffer; the encoder is not running");
+
+        MonitorUpdate update;
+        update.tiles.resize(scene.captures.size());
+        MonitorTile& tile = update.tiles[capNum];
+        tile.analysis = true;
+        tile.weight = 1;
+        tile.score = 1234.5;
+        tile.area = 321.0;
+        tile.vel = 12.3;
+        tile.area_n = 7;
+        update.liveIndex = capNum;
+        measure("composeMonitor", size, [&](const int i) {
+            tile.frame = frames[i % frames.size()];
+            tile.score = 1234.5 + i%2; // the stats row is rewritten every MONITOR_STATS_INTERVAL frames
+            update.live = tile.frame;
+            update.frameNum = i;
+            scene.monitorCompositor.compose(update);
+            return (double)scene.monitorCompositor.canvas.at<cv::Vec3b>(56, 100)[1];
+        }, "live camera: thumbnail, preview and stats text, on the calling thread");
+    }
+
+    // Runs the capture step of a scoring method over the whole video of an opened capture.
+    // Returns what the scene would receive, without the frames. blobs gets the blobs of every frame,
+    // stepMs the time of every step that processed a frame.
+    static std::vector<FrameSlot> runCapture(Capture& cap, const ScoringMethod& method, Scoreboard& board,
+                                             std::vector<BlobStats>* blobs = nullptr, std::vector<double>* stepMs = nullptr){
+        cap.setRing(2, OVERFLOW_BLOCK);
+        cap.setScoreboard(&board, 0);
+        const CaptureStep step = method.select(false);
+        std::vector<FrameSlot> slots;
+        FrameSlot slot;
+        while(1){
+            const unsigned int frameNum = cap.processedFrameNum;
+            auto start = std::chrono::steady_clock::now();
+            const TaskStatus status = (cap.*step)();
+            if(cap.processedFrameNum != frameNum){
+                if(stepMs) stepMs->push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+                if(blobs) blobs->push_back(cap.blobs);
+            }
+            while(cap.ring.tryPop(slot)){ // the scene side, out of the counted step
+                slot.frame.release();
+                slots.push_back(slot);
+            }
+            if(status == TASK_FINISHED) break;
+        }
+        return slots;
+    }
+
+    static bool sameBlobs(const BlobStats& a, const BlobStats& b){
+        return a.area == b.area && a.polygonArea == b.polygonArea && a.centroid == b.centroid && a.box == b.box && a.totalArea == b.totalArea;
+    }
+
+    // Every scoring method with 1 and STRIPE_CHECK_STRIPES stripes, without and with the motion gate
+    void checkStripes(const cv::Size size, const std::vector<cv::Mat>& frames){
+        const std::string video = writeVideo(size, frames, ALLOC_CHECK_LOOPS);
+        TaskScheduler stripePool("BENCH");
+        stripePool.start(STRIPE_CHECK_STRIPES, {});
+        Scoreboard board;
+        board.reset(1);
+        const double gateThreshold = Capture::gateThreshold;
+        for(const auto& [name, method] : Capture::scoringMethods()){
+            for(const double gate : {0.0, (double)STRIPE_CHECK_GATE}){
+                Capture::gateThreshold = gate;
+                std::vector<FrameSlot> slots[2];
+                std::vector<BlobStats> blobs[2];
+                std::vector<double> stepMs[2];
+                const int stripeCounts[2] = {1, STRIPE_CHECK_STRIPES};
+                for(int k = 0; k < 2; k++){
+                    Capture cap("StripeCheck", video, true);
+                    cap.openSource();
+                    if(stripeCounts[k] > 1) cap.setStripes(stripeCounts[k], [&stripePool](const int count, const StripeBody& body) {stripePool.parallelFor(count, body);});
+                    slots[k] = runCapture(cap, method, board, &blobs[k], &stepMs[k]);
+                    if(!checksOnly && gate == 0){
+                        results.push_back({"captureStep " + std::string(name) + " " + std::to_string(stripeCounts[k]) + " stripes", size, stepMs[k], 0,
+                                           "decode and analysis of a frame, one pass over the video"});
+                        for(const auto& s : slots[k]) results.back().checksum += s.score;
+                        std::cout << "  " << results.back().name << " " << size.width << "x" << size.height << ": " << std::fixed
+                                  << std::setprecision(4) << mean(stepMs[k]) << " ms (" << stepMs[k].size() << " frames)" << std::endl;
+                    }
+                }
+                // The last processed frame has blobs but is not delivered: compare up to the longest of the two
+                const size_t frameCount = std::max(blobs[0].size(), blobs[1].size());
+                StripeCheck r{std::string(name), size, gate, frameCount, 0, -1};
+                for(int i = 0; i < frameCount; i++){
+                    bool same = i < blobs[0].size() && i < blobs[1].size() && sameBlobs(blobs[0][i], blobs[1][i]);
+                    if(i < slots[0].size() || i < slots[1].size()){
+                        same = same && i < slots[0].size() && i < slots[1].size();
+                        if(same){
+                            const FrameSlot& a = slots[0][i];
+                            const FrameSlot& b = slots[1][i];
+                            same = a.frameNum == b.frameNum && a.score == b.score && a.area == b.area && a.vel == b.vel && a.area_n == b.area_n;
+                        }
+                    }
+                    if(same) continue;
+                    r.differingFrames++;
+                    if(r.firstDifference < 0) r.firstDifference = i;
+                }
+                std::cout << "  stripes " << r.method << " (gate " << gate << "): " << r.differingFrames << " of " << r.frames
+                          << " frames differ between 1 and " << STRIPE_CHECK_STRIPES << " stripes" << std::endl;
+                stripeChecks.push_back(r);
+            }
+        }
+        Capture::gateThreshold = gateThreshold;
+    }
+
+    void compareFlow(const cv::Size size, const std::vector<cv::Mat>& frames){
+        const std::string video = writeVideo(size, frames, ALLOC_CHECK_LOOPS);
+        const ScoringMethod& method = Capture::scoringMethods().at("FrameDiffAreaAndVel");
+        Scoreboard board;
+        board.reset(1);
+        Capture incremental("FlowIncremental", video, true), full("FlowFull", video, true);
+        incremental.openSource();
+        full.openSource();
+        full.setIncrementalFlow(false);
+        const std::vector<FrameSlot> a = runCapture(incremental, method, board), b = runCapture(full, method, board);
+        FlowComparison r{size, 0, incremental.flowStats().lkPoints, full.flowStats().lkPoints, incremental.flowStats().trackedPoints, 0, 0, 0, 0};
+        for(int i = 0; i < std::min(a.size(), b.size()); i++){
+            if(a[i].area_n == 0 || b[i].area_n == 0) continue; // no speed without blobs
+            r.frames++;
+            r.meanSpeedIncremental += a[i].vel;
+            r.meanSpeedFull += b[i].vel;
+            r.meanSpeedDiff += std::abs(a[i].vel - b[i].vel);
+            if(b[i].score > 0) r.maxScoreRelDiff = std::max(r.maxScoreRelDiff, std::abs(a[i].score - b[i].score)/b[i].score);
+        }
+        if(r.frames > 0){
+            r.meanSpeedIncremental /= r.frames;
+            r.meanSpeedFull /= r.frames;
+            r.meanSpeedDiff /= r.frames;
+        }
+        std::cout << "  flow incremental/full: " << r.lkPointsIncremental << "/" << r.lkPointsFull << " Lucas-Kanade points, mean speed "
+                  << std::setprecision(2) << r.meanSpeedIncremental << "/" << r.meanSpeedFull << ", max score difference "
+                  << 100*r.maxScoreRelDiff << "%" << std::endl;
+        flowComparisons.push_back(r);
+    }
+
+    // The real capture step of every scoring method, serial and split in stripes, with the motion gate on:
+    // once the scratch buffers are warm a frame must not allocate
+    void checkAllocations(const cv::Size size, const std::vector<cv::Mat>& frames){
+        const std::string video = writeVideo(size, frames, ALLOC_CHECK_LOOPS);
+        TaskScheduler stripePool("BENCH");
+        stripePool.start(ALLOC_CHECK_STRIPES, {});
+        Scoreboard board;
+        board.reset(1);
+        const double gateThreshold = Capture::gateThreshold;
+        Capture::gateThreshold = 2;
+        for(const auto& [name, method] : Capture::scoringMethods()){
+            for(const int stripes : {1, ALLOC_CHECK_STRIPES}){
+                Capture cap("AllocCheck", video, true);
+                cap.openSource();
+                if(stripes > 1) cap.setStripes(stripes, [&stripePool](const int count, const StripeBody& body) {stripePool.parallelFor(count, body);});
+                runCapture(cap, method, board);
+                AllocationResult r{std::string(name), size, stripes, cap.stats.steadyFrames, cap.stats.steadyAllocations,
+                                   cap.stats.allocatingFrames, cap.stats.foreignAllocations};
+                std::cout << "  allocations " << r.method << " (" << stripes << " stripes): " << r.allocations << " in " << r.frames
+                          << " frames, " << r.foreign << " by the decoder and OpenCV" << std::endl;
+                allocations.push_back(r);
+            }
+        }
+        Capture::gateThreshold = gateThreshold;
+    }
+
+public:
+    KernelBench(const double _minTimeMs, const bool _checksOnly, const std::string& _gateVideo){
+        minTimeMs = _minTimeMs;
+        checksOnly = _checksOnly;
+        gateVideo = _gateVideo;
+        sizes = {cv::Size(576, 224), cv::Size(640, 360), cv::Size(1920, 1080)};
+        workDir = std::filesystem::temp_directory_path() / "multicamswitch_bench";
+        std::filesystem::create_directories(workDir);
+    }
+
+    void run(){
+        std::vector<std::vector<cv::Mat>> frames;
+        std::vector<std::string> videos;
+        for(const auto& size : sizes){
+            frames.push_back(syntheticFrames(size));
+            videos.push_back(writeVideo(size, frames.back()));
+        }
+
+        Scene scene(writeConfig(videos));
+        scene.outVideo.release(); // only the scene side of the output is measured
+        // General monitor canvas, without its thread, encoder and window
+        scene.monitorCompositor.open(scene.captures.size(), nullptr, 1, 0);
+
+        for(int i = 0; i < sizes.size(); i++){
+            Capture& cap = *scene.captures[i];
+            std::cout << "[BENCH] " << sizes[i].width << "x" << sizes[i].height << std::endl;
+            checkAccuracy(cap, sizes[i], frames[i]);
+            checkBlobs(cap, sizes[i], frames[i]);
+            checkGateChanged(cap, sizes[i], frames[i]);
+            checkGateVideo("synthetic", videos[i]);
+            checkStripes(sizes[i], frames[i]);
+            if(!checksOnly){
+                benchCapture(cap, sizes[i], frames[i]);
+                benchScene(scene, i, sizes[i], frames[i]);
+                compareFlow(sizes[i], frames[i]);
+            }
+            if(AllocCounter::enabled()) checkAllocations(sizes[i], frames[i]);
+        }
+        if(!gateVideo.empty()){
+            std::cout << "[BENCH] " << gateVideo << std::endl;
+            checkGateVideo(gateVideo, gateVideo);
+        }
+        if(!AllocCounter::enabled()) std::cout << "[BENCH] allocation check skipped, build with -DMULTICAMSWITCH_ALLOC_COUNTING=ON" << std::endl;
+    }
+
+    // Kernels further from their OpenCV chain than their bound
+    int accuracyFailures()const{
+        int failures = 0;
+        for(const auto& a : accuracy) if(a.maxAbsDiff > a.bound || (a.bound == 0 && a.differingPixels > 0)) failures++;
+        return failures;
+    }
+
+    // Sizes where the blobs are further from the contours than the tolerances
+    int contourFailures()const{
+        int failures = 0;
+        for(const auto& c : contourChecks){
+            if(c.unmatched > 0 || c.totalAreaRelDiff > BLOB_AREA_TOLERANCE || c.maxCentroidDist > BLOB_CENTROID_TOLERANCE) failures++;
+        }
+        return failures;
+    }
+
+    // Gate checks whose gated mask is not inside the ungated one, loses more than its bound, or differs with every tile changed
+    int gateFailures()const{
+        int failures = 0;
+        for(const auto& g : gateChecks){
+            if(g.frames == 0 || g.extraPixels > 0 || g.lostPixels > g.lostBound || (g.source == "noise" && (g.skippedTiles > 0 || g.lostPixels > 0))) failures++;
+        }
+        return failures;
+    }
+
+    // Scoring methods whose blobs or scores depend on the number of stripes
+    int stripeFailures()const{
+        int failures = 0;
+        for(const auto& s : stripeChecks) if(s.differingFrames > 0 || s.frames == 0) failures++;
+        return failures;
+    }
+
+    // Steps that allocated after the warm up
+    int allocationFailures()const{
+        int failures = 0;
+        for(const auto& a : allocations) if(a.allocations > 0 || a.frames == 0) failures++;
+        return failures;
+    }
+
+    void writeJson(std::ostream& os)const{
+        const char* simdNames[] = {"scalar", "sse41", "avx2"};
+        os << "{\n  \"simd\": \"" << simdNames[simdLevel()] << "\",\n";
+        os << "  \"opencvVersion\": \"" << CV_VERSION << "\",\n";
+        os << "  \"opencvThreads\": " << cv::getNumThreads() << ",\n";
+        os << "  \"benchmarks\": [\n";
+        for(int i = 0; i < results.size(); i++){
+            const BenchResult& r = results[i];
+            os << std::fixed << std::setprecision(6);
+            os << "    {\"name\": \"" << r.name << "\", \"width\": " << r.size.width << ", \"height\": " << r.size.height
+               << ", \"iterations\": " << r.samples.size() << ", \"meanMs\": " << mean(r.samples)
+               << ", \"medianMs\": " << percentile(r.samples, 0.5) << ", \"minMs\": " << percentile(r.samples, 0)
+               << ", \"p95Ms\": " << percentile(r.samples, 0.95) << ", \"checksum\": " << r.checksum
+               << ", \"note\": \"" << r.note << "\"}"
+               << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        os << "  ],\n  \"accuracy\": [\n";
+        for(int i = 0; i < accuracy.size(); i++){
+            const AccuracyResult& a = accuracy[i];
+            os << "    {\"name\": \"" << a.name << "\", \"width\": " << a.size.width << ", \"height\": " << a.size.height
+               << ", \"simd\": \"" << simdNames[a.simd] << "\", \"maxAbsDiff\": " << a.maxAbsDiff << ", \"bound\": " << a.bound
+               << ", \"differingPixels\": " << a.differingPixels << "}"
+               << (i + 1 < accuracy.size() ? "," : "") << "\n";
+        }
+        os << "  ],\n  \"contours\": [\n";
+        for(int i = 0; i < contourChecks.size(); i++){
+            const ContourCheck& c = contourChecks[i];
+            os << "    {\"width\": " << c.size.width << ", \"height\": " << c.size.height << ", \"frames\": " << c.frames
+               << ", \"blobs\": " << c.blobs << ", \"contours\": " << c.contours << ", \"unmatched\": " << c.unmatched
+               << ", \"maxAreaDiff\": " << c.maxAreaDiff << ", \"totalAreaRelDiff\": " << c.totalAreaRelDiff
+               << ", \"areaTolerance\": " << BLOB_AREA_TOLERANCE << ", \"maxCentroidDist\": " << c.maxCentroidDist
+               << ", \"centroidTolerance\": " << BLOB_CENTROID_TOLERANCE << "}"
+               << (i + 1 < contourChecks.size() ? "," : "") << "\n";
+        }
+        os << "  ],\n  \"gate\": [\n";
+        for(int i = 0; i < gateChecks.size(); i++){
+            const GateCheck& g = gateChecks[i];
+            os << "    {\"source\": \"" << g.source << "\", \"width\": " << g.size.width << ", \"height\": " << g.size.height
+               << ", \"threshold\": " << g.threshold << ", \"frames\": " << g.frames << ", \"tiles\": " << g.tiles
+               << ", \"skippedTiles\": " << g.skippedTiles << ", \"maskPixels\": " << g.maskPixels << ", \"extraPixels\": " << g.extraPixels
+               << ", \"lostPixels\": " << g.lostPixels << ", \"lostBound\": " << g.lostBound << "}"
+               << (i + 1 < gateChecks.size() ? "," : "") << "\n";
+        }
+        os << "  ],\n  \"stripes\": [\n";
+        for(int i = 0; i < stripeChecks.size(); i++){
+            const StripeCheck& s = stripeChecks[i];
+            os << "    {\"method\": \"" << s.method << "\", \"width\": " << s.size.width << ", \"height\": " << s.size.height
+               << ", \"gate\": " << s.gate << ", \"stripes\": " << STRIPE_CHECK_STRIPES << ", \"frames\": " << s.frames
+               << ", \"differingFrames\": " << s.differingFrames << ", \"firstDifference\": " << s.firstDifference << "}"
+               << (i + 1 < stripeChecks.size() ? "," : "") << "\n";
+        }
+        os << "  ],\n  \"allocations\": [\n";
+        for(int i = 0; i < allocations.size(); i++){
+            const AllocationResult& a = allocations[i];
+            os << "    {\"method\": \"" << a.method << "\", \"width\": " << a.size.width << ", \"height\": " << a.size.height
+               << ", \"stripes\": " << a.stripes << ", \"frames\": " << a.frames << ", \"allocations\": " << a.allocations
+               << ", \"allocatingFrames\": " << a.allocatingFrames << ", \"foreignAllocations\": " << a.foreign << "}"
+               << (i + 1 < allocations.size() ? "," : "") << "\n";
+        }
+        os << "  ],\n  \"flowComparison\": [\n";
+        for(int i = 0; i < flowComparisons.size(); i++){
+            const FlowComparison& f = flowComparisons[i];
+            os << "    {\"width\": " << f.size.width << ", \"height\": " << f.size.height << ", \"frames\": " << f.frames
+               << ", \"lkPointsIncremental\": " << f.lkPointsIncremental << ", \"lkPointsFull\": " << f.lkPointsFull
+               << ", \"trackedPoints\": " << f.trackedPoints << ", \"meanSpeedIncremental\": " << f.meanSpeedIncremental
+               << ", \"meanSpeedFull\": " << f.meanSpeedFull << ", \"meanSpeedDiff\": " << f.meanSpeedDiff
+               << ", \"maxScoreRelDiff\": " << f.maxScoreRelDiff << "}"
+               << (i + 1 < flowComparisons.size() ? "," : "") << "\n";
+        }
+        os << "  ]\n}\n";
+    }
+};
+
+int main(int argc, char** argv){
+    std::string outPath = "bench.json";
+    double minTimeMs = 300;
+    bool checksOnly = false;
+    std::string gateVideo;
+    std::vector<std::string> args(argv, argv + argc);
+    for(int i = 1; i < args.size(); i++){
+        if(args[i] == "--out" && i + 1 < args.size()) outPath = args[++i];
+        else if(args[i] == "--min-time" && i + 1 < args.size()) minTimeMs = std::stod(args[++i]);
+        else if(args[i] == "--check") checksOnly = true;
+        else if(args[i] == "--video" && i + 1 < args.size()) gateVideo = args[++i];
+        else if(args[i] == "--simd" && i + 1 < args.size()){
+            const std::string level = args[++i];
+            if(level == "scalar") simdLevelCap = SIMD_SCALAR;
+            else if(level == "sse41") simdLevelCap = SIMD_SSE41;
+            else if(level == "avx2") simdLevelCap = SIMD_AVX2;
+            else{
+                std::cerr << "Unknown SIMD level '" << level << "' [scalar, sse41, avx2]" << std::endl;
+                return 1;
+            }
+        } else{
+            std::cout << "Usage: MultiCamSwitchBench [--out <file.json>] [--min-time <ms>] [--simd scalar|sse41|avx2] [--check] [--video <file>]" << std::endl;
+            return args[i] == "-h" || args[i] == "--help" ? 0 : 1;
+        }
+    }
+
+    KernelBench bench(minTimeMs, checksOnly, gateVideo);
+    try{
+        bench.run();
+    } catch(const std::exception& e){
+        std::cerr << "[BENCH ERROR]: " << e.what() << std::endl;
+        return 1;
+    }
+    std::ofstream out(outPath);
+    if(!out.is_open()){
+        std::cerr << "[BENCH ERROR]: Unable to write " << outPath << std::endl;
+        return 1;
+    }
+    bench.writeJson(out);
+    std::cout << "Results written to " << outPath << std::endl;
+    if(bench.accuracyFailures() > 0){
+        std::cerr << "[BENCH ERROR]: " << bench.accuracyFailures() << " kernels are further from OpenCV than their bound, see \"accuracy\" in " << outPath << std::endl;
+        return 1;
+    }
+    if(bench.contourFailures() > 0){
+        std::cerr << "[BENCH ERROR]: the blobs are further from the OpenCV contours than their tolerance, see \"contours\" in " << outPath << std::endl;
+        return 1;
+    }
+    if(bench.gateFailures() > 0){
+        std::cerr << "[BENCH ERROR]: the gated motion mask differs from the ungated one beyond its bound, see \"gate\" in " << outPath << std::endl;
+        return 1;
+    }
+    if(bench.stripeFailures() > 0){
+        std::cerr << "[BENCH ERROR]: " << bench.stripeFailures() << " scoring methods give different results with stripes, see \"stripes\" in " << outPath << std::endl;
+        return 1;
+    }
+    if(bench.allocationFailures() > 0){
+        std::cerr << "[BENCH ERROR]: " << bench.allocationFailures() << " capture steps allocate in the steady state, see \"allocations\" in " << outPath << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,82 @@
+#include "allocCounter.h"
+#include <cstdlib>
+#include <new>
+
+// Plain thread locals: no constructor, so reading them in operator new never allocates
+static thread_local unsigned long long ownAllocations = 0;
+static thread_local unsigned long long foreignAllocations = 0;
+static thread_local int foreignDepth = 0;
+
+bool AllocCounter::enabled(){
+#ifdef MULTICAMSWITCH_ALLOC_COUNTING
+    return true;
+#else
+    return false;
+#endif
+}
+
+AllocCount AllocCounter::thisThread(){
+    AllocCount count;
+    count.own = ownAllocations;
+    count.foreign = foreignAllocations;
+    return count;
+}
+
+ForeignAllocScope::ForeignAllocScope(){
+    foreignDepth++;
+}
+
+ForeignAllocScope::~ForeignAllocScope(){
+    foreignDepth--;
+}
+
+#ifdef MULTICAMSWITCH_ALLOC_COUNTING
+// The array and nothrow forms of the standard library end up here; the aligned ones (alignas above 16) are not counted
+void* operator new(std::size_t size){
+    if(foreignDepth > 0) foreignAllocations++;
+    else ownAllocations++;
+    void* p = std::malloc(size ? size : 1);
+    if(p == nullptr) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](std::size_t size){
+    return ::operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&)noexcept{
+    try{
+        return ::operator new(size);
+    } catch(...){
+        return nullptr;
+    }
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&)noexcept{
+    return ::operator new(size, std::nothrow);
+}
+
+void operator delete(void* p)noexcept{
+    std::free(p);
+}
+
+void operator delete[](void* p)noexcept{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t)noexcept{
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t)noexcept{
+    std::free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&)noexcept{
+    std::free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&)noexcept{
+    std::free(p);
+}
+#endif
@@ -0,0 +1,36 @@
+#ifndef __ALLOC_COUNTER__
+#define __ALLOC_COUNTER__
+
+// Heap allocation counting, enabled at compile time with MULTICAMSWITCH_ALLOC_COUNTING (cmake -DMULTICAMSWITCH_ALLOC_COUNTING=ON).
+// The global operator new is replaced by one that counts the calls of every thread (the cv::Mat buffers count too:
+// OpenCV allocates their header with new). The allocations of a capture step are the difference of the counters of
+// its thread before and after it; the helpers of a parallelFor do not allocate, only the caller is counted.
+// The decoder and the OpenCV calls we cannot make allocation free run in an ALLOC_FOREIGN_SCOPE and are counted apart.
+// Without the option the counters stay at 0 and ALLOC_FOREIGN_SCOPE expands to nothing.
+
+struct AllocCount{
+    unsigned long long own = 0;
+    unsigned long long foreign = 0; // in an ALLOC_FOREIGN_SCOPE
+};
+
+class AllocCounter{
+public:
+    static bool enabled();
+    static AllocCount thisThread(); // allocations of the calling thread since it started
+};
+
+class ForeignAllocScope{
+public:
+    ForeignAllocScope();
+    ~ForeignAllocScope();
+};
+
+#ifdef MULTICAMSWITCH_ALLOC_COUNTING
+#define ALLOC_CONCAT_(a, b) a##b
+#define ALLOC_CONCAT(a, b) ALLOC_CONCAT_(a, b)
+#define ALLOC_FOREIGN_SCOPE() ForeignAllocScope ALLOC_CONCAT(foreignAllocScope, __LINE__)
+#else
+#define ALLOC_FOREIGN_SCOPE() do{}while(0)
+#endif
+
+#endif
@@ -0,0 +1,122 @@
+#include "asyncVideoWriter.h"
+#include <chrono>
+#include <iomanip>
+
+AsyncVideoWriter::AsyncVideoWriter(const std::string _name){
+    name = _name;
+    framesQueued = 0;
+    framesWritten = 0;
+    queueDepthSum = 0;
+    maxQueueDepth = 0;
+    encodeTimeSum = 0;
+    maxEncodeTime = 0;
+    latencyCount = 0;
+    latencySumNs = 0;
+    lastLatencyNs = 0;
+}
+
+AsyncVideoWriter::~AsyncVideoWriter(){
+    release();
+}
+
+bool AsyncVideoWriter::open(const std::string& path, const int fourcc, const double fps, const cv::Size size, const int queueDepth, const OverflowPolicy policy){
+    release();
+    if(!writer.open(path, fourcc, fps, size)) return false;
+    queue.reset(queueDepth, policy);
+    worker = std::thread(&AsyncVideoWriter::run, this);
+    return true;
+}
+
+void AsyncVideoWriter::run(){
+    TRACE_THREAD_NAME("ENCODER " + name);
+    EncodeJob job;
+    // pop() returns false once the queue is closed and every frame has been written
+    while(queue.pop(job)){
+        TRACE_SCOPE(&trace, "encode");
+        auto start = std::chrono::steady_clock::now();
+        writer.write(job.frame);
+        auto end = std::chrono::steady_clock::now();
+        unsigned long long us = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+        job.frame.release(); // give the buffer back to its pool
+        if(job.captured != std::chrono::steady_clock::time_point()){
+            unsigned long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - job.captured).count();
+            latency.record(ns);
+            latencySumNs.fetch_add(ns, std::memory_order_relaxed);
+            lastLatencyNs.store(ns, std::memory_order_relaxed);
+            latencyCount.fetch_add(1, std::memory_order_relaxed);
+        }
+        encodeTimeSum.fetch_add(us, std::memory_order_relaxed);
+        if(us > maxEncodeTime.load(std::memory_order_relaxed)) maxEncodeTime.store(us, std::memory_order_relaxed);
+        framesWritten.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+PushResult AsyncVideoWriter::write(const cv::Mat& frame, const std::chrono::steady_clock::time_point captured){
+    if(!worker.joinable()) return PUSH_CLOSED;
+    unsigned long long depth = queue.size();
+    const PushResult pushed = queue.push(EncodeJob{frame, captured});
+    if(pushed != PUSH_OK) return pushed;
+    // Only the frames that reach the encoder count, so that queued - written is the backlog
+    queueDepthSum.fetch_add(depth, std::memory_order_relaxed);
+    if(depth > maxQueueDepth.load(std::memory_order_relaxed)) maxQueueDepth.store(depth, std::memory_order_relaxed);
+    framesQueued.fetch_add(1, std::memory_order_relaxed);
+    return PUSH_OK;
+}
+
+void AsyncVideoWriter::release(){
+    // Let the worker drain the queue, then close the file
+    if(worker.joinable()){
+        queue.close();
+        worker.join();
+    }
+    writer.release();
+}
+
+bool AsyncVideoWriter::isOpened()const{
+    return worker.joinable() && writer.isOpened();
+}
+
+size_t AsyncVideoWriter::queueDepth()const{
+    return queue.size();
+}
+
+unsigned long long AsyncVideoWriter::queuedCount()const{
+    return framesQueued.load(std::memory_order_relaxed);
+}
+
+unsigned long long AsyncVideoWriter::writtenCount()const{
+    return framesWritten.load(std::memory_order_relaxed);
+}
+
+unsigned long long AsyncVideoWriter::droppedCount()const{
+    return queue.droppedCount();
+}
+
+double AsyncVideoWriter::meanEncodeMs()const{
+    unsigned long long n = framesWritten.load(std::memory_order_relaxed);
+    return n ? encodeTimeSum.load(std::memory_order_relaxed)/(1000.0*n) : 0;
+}
+
+const LatencyHistogram& AsyncVideoWriter::glassToGlass()const{
+    return latency;
+}
+
+unsigned long long AsyncVideoWriter::latencySamples()const{
+    return latencyCount.load(std::memory_order_relaxed);
+}
+
+double AsyncVideoWriter::latencySumSeconds()const{
+    return latencySumNs.load(std::memory_order_relaxed)/1e9;
+}
+
+double AsyncVideoWriter::lastLatencySeconds()const{
+    return lastLatencyNs.load(std::memory_order_relaxed)/1e9;
+}
+
+std::ostream& operator <<(std::ostream& os, const AsyncVideoWriter& w){
+    unsigned long long queued = w.framesQueued.load(std::memory_order_relaxed);
+    os << w.name << ": " << w.framesWritten << " frames written, " << w.queue.droppedCount() << " dropped, queue depth mean "
+       << std::fixed << std::setprecision(2) << (queued ? w.queueDepthSum.load(std::memory_order_relaxed)/(double)queued : 0)
+       << " max " << w.maxQueueDepth << ", encode time mean " << w.meanEncodeMs() << " ms max " << w.maxEncodeTime/1000.0 << " ms";
+    return os;
+}
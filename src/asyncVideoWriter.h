@@ -0,0 +1,58 @@
+#ifndef __ASYNC_VIDEO_WRITER__
+#define __ASYNC_VIDEO_WRITER__
+
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "frameRing.h"
+#include "trace.h"
+
+// Frame waiting to be encoded, with the time its source frame was captured (default: not measured)
+struct EncodeJob{
+    cv::Mat frame;
+    std::chrono::steady_clock::time_point captured;
+};
+
+// cv::VideoWriter running on its own thread.
+// write() only queues the frame: the caller must not modify the pixels afterwards (give it a pooled buffer).
+// It returns PUSH_DROPPED when the queue drops the frame (OVERFLOW_DROP_NEWEST), PUSH_CLOSED when the writer is not open.
+// With a capture time the writer records the glass to glass latency: from the capture to the frame encoded.
+class AsyncVideoWriter{
+private:
+    std::string name;
+    cv::VideoWriter writer;
+    FrameRing<EncodeJob> queue;
+    std::thread worker;
+    std::atomic<unsigned long long> framesQueued; // accepted by the queue, the dropped frames are not counted
+    std::atomic<unsigned long long> framesWritten;
+    std::atomic<unsigned long long> queueDepthSum; // sampled at every accepted write() to get the mean depth
+    std::atomic<unsigned long long> maxQueueDepth;
+    std::atomic<unsigned long long> encodeTimeSum; // microseconds
+    std::atomic<unsigned long long> maxEncodeTime; // microseconds
+    LatencyHistogram latency; // glass to glass, written by the worker thread, read after release()
+    std::atomic<unsigned long long> latencyCount, latencySumNs, lastLatencyNs;
+    void run();
+public:
+    TraceTrack trace; // encode latency, recorded by the worker thread
+    AsyncVideoWriter(const std::string _name = "writer");
+    ~AsyncVideoWriter();
+    bool open(const std::string& path, const int fourcc, const double fps, const cv::Size size, const int queueDepth, const OverflowPolicy policy);
+    PushResult write(const cv::Mat& frame, const std::chrono::steady_clock::time_point captured = {});
+    void release();
+    bool isOpened()const;
+    size_t queueDepth()const;
+    unsigned long long queuedCount()const;
+    unsigned long long writtenCount()const;
+    unsigned long long droppedCount()const;
+    double meanEncodeMs()const;
+    const LatencyHistogram& glassToGlass()const; // complete once the writer is released
+    unsigned long long latencySamples()const;
+    double latencySumSeconds()const;
+    double lastLatencySeconds()const;
+    friend std::ostream& operator <<(std::ostream& os, const AsyncVideoWriter& w);
+};
+
+#endif
@@ -0,0 +1,115 @@
+#include "backgroundModel.h"
+#include "simdDispatch.h"
+#include <cstring>
+#include <algorithm>
+
+BackgroundModel::BackgroundModel(){
+    rows = 0;
+    cols = 0;
+    shift = BACKGROUND_SHIFT;
+}
+
+void BackgroundModel::setShift(const int _shift){
+    shift = _shift;
+}
+
+// ---- Foreground test and background update of a row ----
+// up/down: how far the pixel is above/below the background, one of them is 0. The background never overshoots the pixel.
+
+static void updateRowScalar(const uchar* x, uint16_t* bg, const int shift, const uint16_t threshold, uint64_t* out, const int from, const int cols){
+    for(int i = from; i < cols; i++){
+        const uint16_t v = x[i] << 8;
+        const uint16_t up = v > bg[i] ? v - bg[i] : 0;
+        const uint16_t down = bg[i] > v ? bg[i] - v : 0;
+        if((up | down) > threshold) out[i >> 6] |= (uint64_t)1 << (i & 63);
+        bg[i] = bg[i] + (up >> shift) - (down >> shift);
+    }
+}
+
+#ifdef SIMD_X86
+// 16 pixels, returns 0xFFFF on the 16 bit lanes that are background
+SIMD_TARGET_AVX2 static inline __m256i updateAVX2(const __m128i px, uint16_t* bg, const __m128i shift, const __m256i threshold){
+    const __m256i v = _mm256_slli_epi16(_mm256_cvtepu8_epi16(px), 8);
+    __m256i b = _mm256_loadu_si256((const __m256i*)bg);
+    const __m256i up = _mm256_subs_epu16(v, b), down = _mm256_subs_epu16(b, v);
+    const __m256i isBackground = _mm256_cmpeq_epi16(_mm256_subs_epu16(_mm256_or_si256(up, down), threshold), _mm256_setzero_si256());
+    b = _mm256_sub_epi16(_mm256_add_epi16(b, _mm256_srl_epi16(up, shift)), _mm256_srl_epi16(down, shift));
+    _mm256_storeu_si256((__m256i*)bg, b);
+    return isBackground;
+}
+
+SIMD_TARGET_AVX2 static int updateRowAVX2(const uchar* x, uint16_t* bg, const int shift, const uint16_t threshold, uint64_t* out, const int cols){
+    const __m256i t = _mm256_set1_epi16((short)threshold);
+    const __m128i s = _mm_cvtsi32_si128(shift);
+    int i = 0;
+    for(; i <= cols - 32; i += 32){
+        const __m256i px = _mm256_loadu_si256((const __m256i*)(x + i));
+        const __m256i lo = updateAVX2(_mm256_castsi256_si128(px), bg + i, s, t);
+        const __m256i hi = updateAVX2(_mm256_extracti128_si256(px, 1), bg + i + 16, s, t);
+        // packs works on 128 bit lanes: put the four groups of 8 pixels back in order
+        const uint32_t isBackground = (uint32_t)_mm256_movemask_epi8(_mm256_permute4x64_epi64(_mm256_packs_epi16(lo, hi), 0xD8));
+        out[i >> 6] |= (uint64_t)(~isBackground) << (i & 63);
+    }
+    return i;
+}
+
+SIMD_TARGET_SSE41 static inline __m128i updateSSE41(const __m128i px, uint16_t* bg, const __m128i shift, const __m128i threshold){
+    const __m128i v = _mm_slli_epi16(_mm_cvtepu8_epi16(px), 8);
+    __m128i b = _mm_loadu_si128((const __m128i*)bg);
+    const __m128i up = _mm_subs_epu16(v, b), down = _mm_subs_epu16(b, v);
+    const __m128i isBackground = _mm_cmpeq_epi16(_mm_subs_epu16(_mm_or_si128(up, down), threshold), _mm_setzero_si128());
+    b = _mm_sub_epi16(_mm_add_epi16(b, _mm_srl_epi16(up, shift)), _mm_srl_epi16(down, shift));
+    _mm_storeu_si128((__m128i*)bg, b);
+    return isBackground;
+}
+
+SIMD_TARGET_SSE41 static int updateRowSSE41(const uchar* x, uint16_t* bg, const int shift, const uint16_t threshold, uint64_t* out, const int cols){
+    const __m128i t = _mm_set1_epi16((short)threshold);
+    const __m128i s = _mm_cvtsi32_si128(shift);
+    int i = 0;
+    for(; i <= cols - 16; i += 16){
+        const __m128i px = _mm_loadu_si128((const __m128i*)(x + i));
+        const __m128i lo = updateSSE41(px, bg + i, s, t);
+        const __m128i hi = updateSSE41(_mm_srli_si128(px, 8), bg + i + 8, s, t);
+        const uint32_t isBackground = (uint32_t)_mm_movemask_epi8(_mm_packs_epi16(lo, hi)) & 0xFFFF;
+        out[i >> 6] |= (uint64_t)(~isBackground & 0xFFFF) << (i & 63);
+    }
+    return i;
+}
+#endif
+
+static void updateRow(const uchar* x, uint16_t* bg, const int shift, const uint16_t threshold, uint64_t* out, const int words, const int cols){
+    std::memset(out, 0, words*sizeof(uint64_t));
+    int i = 0;
+#ifdef SIMD_X86
+    switch(simdLevel()){
+        case SIMD_AVX2: i = updateRowAVX2(x, bg, shift, threshold, out, cols); break;
+        case SIMD_SSE41: i = updateRowSSE41(x, bg, shift, threshold, out, cols); break;
+        default: break;
+    }
+#endif
+    updateRowScalar(x, bg, shift, threshold, out, i, cols);
+}
+
+void BackgroundModel::run(const cv::Mat& curr, const int threshold, BinaryMask& out, const int stripes, const ParallelFor& parallelFor){
+    out.create(curr.rows, curr.cols);
+    if(curr.rows != rows || curr.cols != cols){
+        // Seed the background with the frame: no foreground yet
+        rows = curr.rows;
+        cols = curr.cols;
+        background.resize(rows*cols);
+        for(int y = 0; y < rows; y++){
+            const uchar* x = curr.ptr<uchar>(y);
+            for(int i = 0; i < cols; i++) background[y*cols + i] = x[i] << 8;
+        }
+        std::fill(out.bits.begin(), out.bits.end(), 0);
+        return;
+    }
+    const uint16_t fixedThreshold = std::min(threshold, 255) << 8;
+    const int n = std::max(1, stripes);
+    parallelFor(n, [&](const int i){
+        int y0, y1;
+        stripeRows(i, n, rows, y0, y1);
+        for(int y = y0; y < y1; y++) updateRow(curr.ptr<uchar>(y), background.data() + y*cols, shift, fixedThreshold, out.row(y), out.wordsPerRow, cols);
+    });
+}
@@ -0,0 +1,30 @@
+#ifndef __BACKGROUND_MODEL__
+#define __BACKGROUND_MODEL__
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include <cstdint>
+#include "motionKernel.h"
+#include "stripes.h"
+
+#define BACKGROUND_SHIFT 6 // default learning rate of the background, 1/2^BACKGROUND_SHIFT per analyzed frame
+
+// Per pixel running average of the preprocessed frames, kept in 8.8 fixed point (uint16_t).
+// In a single pass every pixel is compared with the background (foreground if the difference is above the
+// threshold) and the background moves towards it by 1/2^shift: the update is a saturating subtraction, a
+// shift and an add on 16 bit lanes, 16 or 32 pixels at a time.
+class BackgroundModel{
+    friend class KernelBench; // bench/kernelBench.cpp compares the accumulators of the code paths
+private:
+    std::vector<uint16_t> background; // rows*cols, value << 8
+    int rows;
+    int cols;
+    int shift;
+public:
+    BackgroundModel();
+    void setShift(const int _shift);
+    // Foreground mask of curr, then curr is learned. The first frame (or a new size) only seeds the background.
+    void run(const cv::Mat& curr, const int threshold, BinaryMask& out, const int stripes = 1, const ParallelFor& parallelFor = serialFor);
+};
+
+#endif
@@ -0,0 +1,211 @@
+#include "blobExtractor.h"
+
+int BlobStats::size()const{
+    return area.size();
+}
+
+void BlobStats::clear(){
+    // clear() keeps the capacity of the vectors
+    area.clear();
+    polygonArea.clear();
+    centroid.clear();
+    box.clear();
+    totalArea = 0;
+}
+
+void BlobStats::reserve(const int blobs){
+    area.reserve(blobs);
+    polygonArea.reserve(blobs);
+    centroid.reserve(blobs);
+    box.reserve(blobs);
+}
+
+void BlobExtractor::Runs::reserve(const int n){
+    y.reserve(n);
+    x0.reserve(n);
+    x1.reserve(n);
+    parent.reserve(n);
+    contourPoints.reserve(n);
+}
+
+void BlobExtractor::Runs::clear(){
+    y.clear();
+    x0.clear();
+    x1.clear();
+    parent.clear();
+    contourPoints.clear();
+}
+
+int BlobExtractor::findRoot(std::vector<int>& parent, int run){
+    while(parent[run] != run){
+        parent[run] = parent[parent[run]]; // path halving
+        run = parent[run];
+    }
+    return run;
+}
+
+void BlobExtractor::unite(std::vector<int>& parent, const int a, const int b){
+    int ra = findRoot(parent, a), rb = findRoot(parent, b);
+    // The root is always the first run of the blob: blobs come out in raster order
+    if(ra < rb) parent[rb] = ra;
+    else if(rb < ra) parent[ra] = rb;
+}
+
+// Word v of a row, 0 outside the mask
+static inline uint64_t maskWord(const BinaryMask& mask, const uint64_t* row, const int v){
+    if(row == nullptr || v < 0 || v >= mask.wordsPerRow) return 0;
+    return v == mask.wordsPerRow - 1 ? row[v] & mask.lastWordMask() : row[v];
+}
+
+int BlobExtractor::contourPoints(const BinaryMask& mask, const uint64_t* above, const uint64_t* row, const uint64_t* below, const int start, const int end){
+    // 8-connectivity crossing number of every pixel of [start, end): the unset 4-neighbours followed
+    // (counterclockwise) by a set diagonal or 4-neighbour, 64 pixels at a time
+    int points = 0;
+    for(int v = start >> 6; v <= (end - 1) >> 6; v++){
+        uint64_t span = ~(uint64_t)0;
+        if(v == start >> 6) span &= ~(uint64_t)0 << (start & 63);
+        if(v == (end - 1) >> 6) span &= ~(uint64_t)0 >> (63 - ((end - 1) & 63));
+        const uint64_t c = maskWord(mask, row, v), n = maskWord(mask, above, v), s = maskWord(mask, below, v);
+        // bit x of east is pixel x + 1, bit x of west is pixel x - 1
+        const uint64_t e = (c >> 1) | (maskWord(mask, row, v + 1) << 63), w = (c << 1) | (maskWord(mask, row, v - 1) >> 63);
+        const uint64_t ne = (n >> 1) | (maskWord(mask, above, v + 1) << 63), nw = (n << 1) | (maskWord(mask, above, v - 1) >> 63);
+        const uint64_t se = (s >> 1) | (maskWord(mask, below, v + 1) << 63), sw = (s << 1) | (maskWord(mask, below, v - 1) >> 63);
+        points += __builtin_popcountll(span & ~e & (ne | n)) + __builtin_popcountll(span & ~n & (nw | w))
+                + __builtin_popcountll(span & ~w & (sw | s)) + __builtin_popcountll(span & ~s & (se | e));
+    }
+    return points;
+}
+
+void BlobExtractor::extractRuns(const BinaryMask& mask, const int y0, const int y1, Runs& out){
+    out.clear();
+    int prevBegin = 0, prevEnd = 0; // runs of the previous row
+    for(int y = y0; y < y1; y++){
+        const uint64_t* row = mask.row(y);
+        // Outside the mask is background, as for findContours
+        const uint64_t* above = y > 0 ? mask.row(y - 1) : nullptr;
+        const uint64_t* below = y + 1 < mask.rows ? mask.row(y + 1) : nullptr;
+        const int rowBegin = out.x0.size();
+        int x = 0;
+        // Extract the runs of the row, whole words of zeros are skipped
+        while(x < mask.cols){
+            int w = x >> 6;
+            uint64_t bits = row[w] & (~(uint64_t)0 << (x & 63));
+            while(!bits && ++w < mask.wordsPerRow) bits = row[w];
+            if(!bits) break;
+            const int start = (w << 6) + __builtin_ctzll(bits);
+            // end of the run: first zero after start
+            uint64_t zeros = ~row[w] & (~(uint64_t)0 << (start & 63));
+            while(!zeros && ++w < mask.wordsPerRow) zeros = ~row[w];
+            int end = zeros ? (w << 6) + __builtin_ctzll(zeros) : mask.cols;
+            if(end > mask.cols) end = mask.cols;
+
+            const int id = out.x0.size();
+            out.y.push_back(y);
+            out.x0.push_back(start);
+            out.x1.push_back(end - 1);
+            out.parent.push_back(id);
+            out.contourPoints.push_back(contourPoints(mask, above, row, below, start, end));
+            // 8-connectivity with the runs of the previous row that touch [start - 1, end]
+            while(prevBegin < prevEnd && out.x1[prevBegin] < start - 1) prevBegin++;
+            for(int p = prevBegin; p < prevEnd && out.x0[p] <= end; p++) unite(out.parent, p, id);
+            x = end;
+        }
+        prevBegin = rowBegin;
+        prevEnd = out.x0.size();
+    }
+}
+
+int BlobExtractor::reserve(const cv::Size size, const int stripes){
+    // A row has at most (cols + 1)/2 runs, and a blob at least one run
+    const int runsPerRow = (size.width + 1)/2;
+    const int n = std::max(1, stripes);
+    runs.reserve(runsPerRow*size.height);
+    blobOfRun.reserve(runsPerRow*size.height);
+    if(stripeRuns.size() < n) stripeRuns.resize(n);
+    stripeOffset.reserve(n);
+    for(int i = 0; i < n; i++){
+        int y0, y1;
+        stripeRows(i, n, size.height, y0, y1);
+        stripeRuns[i].reserve(runsPerRow*(y1 - y0));
+    }
+    return runsPerRow*size.height;
+}
+
+void BlobExtractor::run(const BinaryMask& mask, const int minArea, BlobStats& out, const int stripes, const ParallelFor& parallelFor){
+    if(stripes <= 1){
+        extractRuns(mask, 0, mask.rows, runs);
+        fold(minArea, out);
+        return;
+    }
+
+    if(stripeRuns.size() < stripes) stripeRuns.resize(stripes);
+    parallelFor(stripes, [&](const int i){
+        int y0, y1;
+        stripeRows(i, stripes, mask.rows, y0, y1);
+        extractRuns(mask, y0, y1, stripeRuns[i]);
+    });
+
+    // Concatenate the stripes in order, the parents are moved to the global indexes
+    runs.clear();
+    stripeOffset.resize(stripes);
+    for(int i = 0; i < stripes; i++){
+        const Runs& s = stripeRuns[i];
+        const int offset = runs.x0.size();
+        stripeOffset[i] = offset;
+        runs.y.insert(runs.y.end(), s.y.begin(), s.y.end());
+        runs.x0.insert(runs.x0.end(), s.x0.begin(), s.x0.end());
+        runs.x1.insert(runs.x1.end(), s.x1.begin(), s.x1.end());
+        for(int p : s.parent) runs.parent.push_back(p + offset);
+        runs.contourPoints.insert(runs.contourPoints.end(), s.contourPoints.begin(), s.contourPoints.end());
+    }
+
+    // Unite the runs that touch across the first row of each stripe and the row above it
+    for(int i = 1; i < stripes; i++){
+        int y0, y1;
+        stripeRows(i, stripes, mask.rows, y0, y1);
+        if(y0 == y1 || y0 == 0) continue;
+        int prevBegin = stripeOffset[i];
+        while(prevBegin > 0 && runs.y[prevBegin - 1] == y0 - 1) prevBegin--;
+        const int prevEnd = stripeOffset[i];
+        for(int id = stripeOffset[i]; id < runs.x0.size() && runs.y[id] == y0; id++){
+            while(prevBegin < prevEnd && runs.x1[prevBegin] < runs.x0[id] - 1) prevBegin++;
+            for(int p = prevBegin; p < prevEnd && runs.x0[p] <= runs.x1[id] + 1; p++) unite(runs.parent, p, id);
+        }
+    }
+    fold(minArea, out);
+}
+
+void BlobExtractor::fold(const int minArea, BlobStats& out){
+    // Fold the runs into their blobs
+    out.clear();
+    blobOfRun.resize(runs.x0.size());
+    for(int i = 0; i < (int)runs.x0.size(); i++){
+        const int root = findRoot(runs.parent, i);
+        const int len = runs.x1[i] - runs.x0[i] + 1;
+        if(root == i){ // first run of a new blob
+            blobOfRun[i] = out.area.size();
+            out.area.push_back(0);
+            out.polygonArea.push_back(0);
+            out.centroid.push_back(cv::Point2f(0, 0));
+            out.box.push_back(cv::Rect(runs.x0[i], runs.y[i], len, 1));
+        } else blobOfRun[i] = blobOfRun[root];
+        const int b = blobOfRun[i];
+        out.area[b] += len;
+        out.polygonArea[b] += runs.contourPoints[i]; // contour points for now
+        // running sums of the coordinates, divided by the area below
+        out.centroid[b].x += len*(runs.x0[i] + runs.x1[i])*0.5f;
+        out.centroid[b].y += len*runs.y[i];
+        cv::Rect& box = out.box[b];
+        const int left = std::min(box.x, runs.x0[i]), right = std::max(box.x + box.width, runs.x1[i] + 1);
+        box.x = left;
+        box.width = right - left;
+        box.height = runs.y[i] - box.y + 1;
+    }
+    for(int b = 0; b < out.size(); b++){
+        out.centroid[b].x /= out.area[b];
+        out.centroid[b].y /= out.area[b];
+        // Pick's theorem on the outer contour: area = pixels - contour points/2 - 1
+        out.polygonArea[b] = std::max(0.0f, out.area[b] - out.polygonArea[b]*0.5f - 1);
+        if(out.polygonArea[b] >= minArea) out.totalArea += out.polygonArea[b]; // Do not include obj with a small area
+    }
+}
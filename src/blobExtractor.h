@@ -0,0 +1,54 @@
+#ifndef __BLOB_EXTRACTOR__
+#define __BLOB_EXTRACTOR__
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include "motionKernel.h"
+#include "stripes.h"
+
+// Blobs of a binary mask as a struct of arrays, index i describes the i-th blob in raster order
+struct BlobStats{
+    std::vector<int> area; // number of pixels
+    std::vector<float> polygonArea; // area of the outer contour, what cv::contourArea gives
+    std::vector<cv::Point2f> centroid;
+    std::vector<cv::Rect> box;
+    double totalArea; // sum of the polygon areas of the blobs that are not smaller than the minimum area
+    int size()const;
+    void clear();
+    void reserve(const int blobs);
+};
+
+// 8-connected labeling of the runs of a packed binary mask, area, centroid and bounding box of every blob
+// are accumulated per run in the same pass: no label image and no contour point lists.
+// The polygon area keeps the semantics of cv::contourArea on the outer contour of findContours: by Pick's theorem
+// it is the pixel count minus half the contour points minus one. A pixel is a contour point once for every pass
+// of the contour through it (its 8-connectivity crossing number: twice on a one pixel neck), so the area is exact
+// for the blobs without holes. A hole is left out of the area, while contourArea includes it.
+// With several stripes the runs are extracted and labeled per stripe in parallel, then the runs that touch
+// across the boundary rows are united: the blobs and their order do not depend on the number of stripes.
+class BlobExtractor{
+private:
+    // Runs of consecutive set pixels, [x0, x1] on row y
+    struct Runs{
+        std::vector<int> y, x0, x1, parent;
+        std::vector<int> contourPoints; // passes of the contour through the pixels of the run
+        void clear();
+        void reserve(const int n);
+    };
+    Runs runs; // all the runs in raster order
+    std::vector<Runs> stripeRuns;
+    std::vector<int> stripeOffset; // index of the first run of each stripe in runs
+    std::vector<int> blobOfRun;
+    static int findRoot(std::vector<int>& parent, int run);
+    static void unite(std::vector<int>& parent, const int a, const int b);
+    static int contourPoints(const BinaryMask& mask, const uint64_t* above, const uint64_t* row, const uint64_t* below, const int start, const int end);
+    static void extractRuns(const BinaryMask& mask, const int y0, const int y1, Runs& out);
+    void fold(const int minArea, BlobStats& out);
+public:
+    // Room for the worst case mask (every other pixel set) of the given size, so that run() never allocates.
+    // Returns the largest number of blobs such a mask can have.
+    int reserve(const cv::Size size, const int stripes);
+    void run(const BinaryMask& mask, const int minArea, BlobStats& out, const int stripes = 1, const ParallelFor& parallelFor = serialFor);
+};
+
+#endif
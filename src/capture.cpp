@@ -1,37 +1,63 @@
 #include "capture.h"
+#include <algorithm>
 #include <chrono>
 #include <thread>
 #include <csignal>
 
-Capture::Capture(std::string _capName, std::string _source, bool _analysis) : VideoCapture(_source){
-    if(!isOpened()){
-        std::cerr << "[CAPTURE " << _capName << "]: Video stream opening error!" << std::endl;
-        exit(1);
-    }
+Capture::Capture(std::string _capName, std::string _source, bool _analysis){
     capName = _capName;
+    trace.setName(_capName);
     source = _source;
     analysis = _analysis;
     processedFrameNum = -1; // frame number that is being processed
-    readyToRetrieve = false;
     isdisplayAnalysis = false;
-    score = 0;
-    active = true;
+    lazyDecode = false;
+    decodeInterval = 1;
+    scoreboard = nullptr;
+    boardIndex = 0;
+    hasPending = false;
+    stripes = 1;
+    parallelFor = serialFor;
+    analysisStride = 1;
+    realtime = false;
+    ingestJitterMs = 0;
+    ingestDropRate = 0;
+    sourceFps = DEFAULT_SOURCE_FPS;
+    openMs = 0;
+    probeMs = 0;
+    ingestRng.seed(std::hash<std::string>{}(_capName)); // the same drops and jitter at every run
     weight = 1;
-    area = 0;
-    area_n = 0;
-    vel = 0;
-    paramToDisplay = {{"FINAL_SCORE", "0"}, {"AREAS_NUM", "0"}, {"WEIGHT", std::to_string(weight)},
-                      {"AVG_SPEED", "0"}, {"AREA", "0"}};
-    cropCoords[0] = 0;
-    cropCoords[1] = get(cv::CAP_PROP_FRAME_HEIGHT);
-    cropCoords[2] = 0;
-    cropCoords[3] = get(cv::CAP_PROP_FRAME_WIDTH);
-    ratio = get(cv::CAP_PROP_FRAME_WIDTH)/get(cv::CAP_PROP_FRAME_HEIGHT);
+    cropSet = false;
+    ratio = 1;
+}
 
+void Capture::openSource(){
+    // Demuxer and decoder setup: the slow part of the startup, the scene opens every camera at the same time
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if(!open(source)) throw std::invalid_argument("Video stream opening error (missing file, unsupported format or unreachable stream)");
+    std::chrono::steady_clock::time_point opened = std::chrono::steady_clock::now();
+    const double width = get(cv::CAP_PROP_FRAME_WIDTH);
+    const double height = get(cv::CAP_PROP_FRAME_HEIGHT);
+    if(!(width > 0 && height > 0)) throw std::invalid_argument("The stream does not report its frame size");
+    if(!cropSet){
+        cropCoords[0] = 0;
+        cropCoords[1] = height;
+        cropCoords[2] = 0;
+        cropCoords[3] = width;
+    }
+    ratio = width/height;
+    sourceFps = get(cv::CAP_PROP_FPS);
+    if(!(sourceFps > 0)) sourceFps = DEFAULT_SOURCE_FPS;
+    std::chrono::steady_clock::time_point probed = std::chrono::steady_clock::now();
+    openMs = std::chrono::duration<double, std::milli>(opened - start).count();
+    probeMs = std::chrono::duration<double, std::milli>(probed - opened).count();
 }
 
 bool Capture::stopSignalReceived = false;
 double Capture::alpha = 0;
+StrideMode Capture::strideMode = STRIDE_HOLD;
+bool Capture::strideShadow = false;
+double Capture::gateThreshold = 0;
 
 std::ostream& operator <<(std::ostream& os, const Capture& cap){
     os << "CAPTURE NAME: " << cap.capName << " CAPTURE PATH: " << cap.source << " RATIO: " << cap.ratio << " ANALYSIS: " << cap.analysis;
@@ -46,6 +72,7 @@ void Capture::setCrop(const int cropArray[]){
     for(int i = 0; i < 4; i++){
         cropCoords[i] = cropArray[i];
     }
+    cropSet = true;
 }
 
 void Capture::setWeight(const int w){
@@ -56,270 +83,478 @@ void Capture::setDisplayAnalysis(const bool da){
     isdisplayAnalysis = da;
 }
 
-void Capture::display(){
-    unsigned int frameNum = 0;
-    cv::Mat currentFrame, resized;
-    while(1){
-        if(!read(currentFrame)) break;
-        if(frameNum > 2 && !getWindowProperty(capName, cv::WND_PROP_VISIBLE)) break; // close the window
-        if(stopSignalReceived) break;
-        cv::resize(currentFrame, resized, cv::Size((int)(ratio*400), 400));
-        cv::namedWindow(capName, cv::WINDOW_NORMAL);
-        imshow(capName, resized);
-        cv::waitKey(1);
-        frameNum++;
+void Capture::startDebugView(){
+    // Only a camera that is analyzed has something to show
+    if(!isdisplayAnalysis || !analysis || debugSink) return;
+    debugSink = std::make_unique<DebugSink>(capName);
+    debugSink->start();
+}
+
+void Capture::setRing(const int depth, const OverflowPolicy policy){
+    ring.reset(depth, policy);
+    // One buffer for each ring slot, plus the frame being decoded, the one held by the scene and the one being written
+    framePool.preallocate(depth + 3, cv::Size(get(cv::CAP_PROP_FRAME_WIDTH), get(cv::CAP_PROP_FRAME_HEIGHT)), CV_8UC3);
+}
+
+void Capture::setScoreboard(Scoreboard* board, const int index){
+    scoreboard = board;
+    boardIndex = index;
+}
+
+void Capture::setLazyDecode(const bool lazy, const int interval){
+    lazyDecode = lazy;
+    decodeInterval = interval;
+}
+
+void Capture::setIncrementalFlow(const bool inc){
+    flowTracker.setIncremental(inc);
+}
+
+void Capture::setAnalysisStride(const int n){
+    analysisStride = n > 0 ? n : 1;
+}
+
+void Capture::setRealtime(const bool rt, const double jitterMs, const double dropRate){
+    realtime = rt;
+    ingestJitterMs = jitterMs;
+    ingestDropRate = dropRate;
+}
+
+double Capture::frameRate()const{
+    return sourceFps;
+}
+
+void Capture::setBackgroundFrames(const int n){
+    int shift = 0;
+    while((1 << (shift + 1)) <= n) shift++;
+    backgroundModel.setShift(shift);
+}
+
+void Capture::setStripes(const int n, const ParallelFor& pf){
+    stripes = n;
+    parallelFor = pf;
+}
+
+double CaptureStats::meanAnalysisMs()const{
+    const unsigned long long n = analyzedFrames.load(std::memory_order_relaxed);
+    return n ? analysisNs.load(std::memory_order_relaxed)/1e6/n : 0;
+}
+
+const DebugSink* Capture::debugView()const{
+    return debugSink.get();
+}
+
+const FlowStats& Capture::flowStats()const{
+    return flowTracker.stats;
+}
+
+TaskStatus Capture::deliver(){
+    // Hand the pending frame over to the scene without waiting: if the ring is full the task backs off
+    if(!hasPending) return TASK_PROGRESS;
+    const double score = pendingSlot.score, area = pendingSlot.area, vel = pendingSlot.vel;
+    const int area_n = pendingSlot.area_n;
+    const unsigned int frameNum = pendingSlot.frameNum;
+    const PushResult pushed = ring.tryPush(pendingSlot);
+    if(pushed == PUSH_OK || pushed == PUSH_DROPPED){
+        // Only the frames the scene will receive are published
+        if(pushed == PUSH_OK) scoreboard->publish(boardIndex, score, area, vel, area_n, frameNum);
+        pendingSlot = FrameSlot(); // drop the references left in the slot
+        hasPending = false;
+        return TASK_PROGRESS;
     }
+    if(pushed == PUSH_CLOSED) return finish();
+    stats.ringFullBackoffs.fetch_add(1, std::memory_order_relaxed);
+    TRACE_INSTANT(&trace, "ringFull");
+    return TASK_BACKOFF;
 }
 
-void Capture::FrameDiffAreaOnly(){
-    printf("FrameDiffAreaOnly thread ID: %d Name: %s\n",std::this_thread::get_id(), capName.c_str());
-    cv::Mat croppedFrame, previousFrame, originalFrame, currDiffFrame;
-    while(isOpened()){
-        active = true;
-        if(!read(originalFrame))break;
-        
-        // Copy the original frame
-        croppedFrame = originalFrame.clone();
-        preProcessing(&croppedFrame);
-
-        // Check if a stop signal has arrived
-        if(stopSignalReceived){
-            readyToRetrieve = true;
-            break;
-        }
-        
-        if(processedFrameNum + 1) {
-            frameDifferencing(&currDiffFrame, &previousFrame, &croppedFrame);
-            std::vector<std::vector<cv::Point>> contours;
-            findContours(currDiffFrame, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
-            double tmpArea = 0, s = 0;
-            int n = contours.size();
-            //Check whether contours.size is greater than 0 before performing the calculation
-            if(n > 0){
-                tmpArea = getArea(contours);
-                s = tmpArea*weight; // calculate the weighted score
-            }
-            //acquire lock
-            std::unique_lock lk(mx);
-            condVar.wait(lk, [this] {return !readyToRetrieve;});
-            
-            score = s; // update the score
-            area = tmpArea; // update the area
-
-            frame.release();
-            frame = originalFrame.clone(); // update the frame
-            readyToRetrieve = true;
-            // Unlock and notify
-            lk.unlock();
-            condVar.notify_one();
-        }
-        previousFrame.release();
-        previousFrame = croppedFrame.clone(); // Save the previous frame
-        croppedFrame.release();
-        currDiffFrame.release();
-        originalFrame.release();
-        ++processedFrameNum;
+bool Capture::decodeFrame(){
+    TRACE_SCOPE(&trace, "decode");
+    originalFrame = framePool.acquire(); // decode straight into a pooled buffer
+    {
+        ALLOC_FOREIGN_SCOPE();
+        if(!read(originalFrame)) return false;
     }
-    active = false;
-    condVar.notify_one();
-}
-
-void Capture::FrameDiffAreaAndVel(){
-    printf("FrameDiffAreaAndVel thread ID: %d Name: %s\n",std::this_thread::get_id(), capName.c_str());
-    cv::Mat croppedFrame, previousFrame, originalFrame, currDiffFrame;
-    while(isOpened()){
-        active = true;
-        if(!read(originalFrame))break;
-        
-        // Copy the original frame
-        croppedFrame = originalFrame.clone();
-        preProcessing(&croppedFrame);
-        
-        // Check if a stop signal has arrived
-        if(stopSignalReceived){
-            readyToRetrieve = true;
-            break;
-        }
+    framePool.adopt(originalFrame);
+    framePool.traffic.countCopy(originalFrame); // the decoder converts its picture into the pooled buffer
+    framePool.traffic.countFrame();
+    stats.decodedFrames.fetch_add(1, std::memory_order_relaxed);
+    pendingSlot.pts = timestamp();
+    pendingSlot.captured = realtime ? frameCaptured : std::chrono::steady_clock::now();
+    return true;
+}
 
-        if(processedFrameNum + 1) {
-            frameDifferencing(&currDiffFrame, &previousFrame, &croppedFrame);
-            //Calculate the score of the frame
-            std::vector<std::vector<cv::Point>> contours;
-            findContours(currDiffFrame, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
-            double tmpArea = 0, avgVel = 0, s = 0;
-            int n = contours.size();
-            //Check whether contours.size is greater than 0 before performing the calculation
-            if(n > 0){
-                tmpArea = getArea(contours);
-                avgVel = getAvgSpeed(croppedFrame, previousFrame, contours);
-                double nalpha = std::pow(n, alpha); // n to the power of alpha
-                s = tmpArea*avgVel*weight*nalpha; // calculate the weighted score
-            }
+TaskStatus Capture::pace(){
+    // Realtime ingest: the file is read like a live camera, one frame every 1/sourceFps seconds.
+    // A frame that is not due yet backs the task off; a dropped frame is grabbed and thrown away.
+    // The due time is the capture time of the frame: if the task runs late, the delay counts in the latency.
+    if(!realtime) return TASK_PROGRESS;
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if(nominalDue == std::chrono::steady_clock::time_point()) nominalDue = nextArrival = now; // the source starts now
+    const std::chrono::steady_clock::duration interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1/sourceFps));
+    std::uniform_real_distribution<double> uniform(0, 1);
+    while(now >= nextArrival){
+        frameCaptured = nextArrival;
+        nominalDue += interval;
+        // Jitter delays a frame but never reorders the frames
+        std::chrono::steady_clock::time_point arrival = nominalDue + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::milli>(ingestJitterMs*uniform(ingestRng)));
+        nextArrival = std::max(nextArrival, arrival);
+        if(ingestDropRate <= 0 || uniform(ingestRng) >= ingestDropRate) return TASK_PROGRESS;
+        ALLOC_FOREIGN_SCOPE();
+        if(!grab()) return finish(); // lost on the way
+        stats.injectedDrops.fetch_add(1, std::memory_order_relaxed);
+    }
+    return TASK_BACKOFF;
+}
 
-            //acquire lock
-            std::unique_lock lk(mx);
-            condVar.wait(lk, [this] {return !readyToRetrieve;});
-            
-            score = s; // update the score
-            area = tmpArea; // update the area
-            vel = avgVel; // update the speed
-            area_n = n; // update areas number
-            if(isdisplayAnalysis) displayAnalysis(currDiffFrame, croppedFrame, contours, tmpArea, avgVel); 
-            frame.release();
-            frame = originalFrame.clone(); // update the frame
-            readyToRetrieve = true;
-            // Unlock and notify
-            lk.unlock();
-            condVar.notify_one();
-        }
+double Capture::timestamp(){
+    // Some sources (e.g. a few webcams) report 0 for every frame: treat it as unknown after the first one
+    ALLOC_FOREIGN_SCOPE();
+    double pts = get(cv::CAP_PROP_POS_MSEC);
+    return pts > 0 || processedFrameNum + 1 == 0 ? pts : -1;
+}
 
-        previousFrame.release();
-        previousFrame = croppedFrame.clone(); // Save the previous frame
-        croppedFrame.release();
-        currDiffFrame.release();
-        originalFrame.release();
-        ++processedFrameNum;
+TaskStatus Capture::finish(){
+    pendingSlot = FrameSlot();
+    hasPending = false;
+    originalFrame.release();
+    scoreboard->setActive(boardIndex, false);
+    if(debugSink) debugSink->close(); // draw what is left and close the file
+    ring.close(); // No more frames: wake up the scene
+    return TASK_FINISHED;
+}
+
+TaskStatus Capture::display(){
+    if(!read(originalFrame)) return TASK_FINISHED;
+    if(processedFrameNum + 1 > 2 && !getWindowProperty(capName, cv::WND_PROP_VISIBLE)) return TASK_FINISHED; // close the window
+    if(stopSignalReceived) return TASK_FINISHED;
+    cv::resize(originalFrame, croppedFrame, cv::Size((int)(ratio*400), 400));
+    cv::namedWindow(capName, cv::WINDOW_NORMAL);
+    imshow(capName, croppedFrame);
+    cv::waitKey(1);
+    ++processedFrameNum;
+    return TASK_PROGRESS;
+}
+
+// ---- Scoring stages ----
+// A scoring method is a mask stage, a speed stage and a score fold, composed at compile time by scoringStep().
+
+// Motion between the previous preprocessed frame and the current one, after the motion gate
+struct Capture::FrameDifferenceMask{
+    static constexpr bool needsPrevious = true;
+    static void seed(Capture& c){}
+    static bool run(Capture& c){
+        if(!c.gateFrame()) return false; // still frame: no motion, no blobs
+        c.frameDifferencing(&c.motionMask, &c.previousFrame, &c.croppedFrame);
+        return true;
     }
-    active = false;
-    condVar.notify_one(); // To unlock the scene while loop
-}
-
-void Capture::grabFrame(){
-    printf("Grab thread ID: %d Name: %s\n",std::this_thread::get_id(), capName.c_str());
-    cv::Mat grabbedFrame;
-    while(isOpened()){
-        active = true;
-        if(!read(grabbedFrame))break;
-        
-        // Check if a stop signal has arrived
-        if(stopSignalReceived){
-            readyToRetrieve = true;
-            break;
-        }
+};
 
-        //acquire lock
-        std::unique_lock lk(mx);
-        condVar.wait(lk, [this] {return !readyToRetrieve;});
-        
-        frame.release();
-        frame = grabbedFrame.clone(); // update the frame
-        readyToRetrieve = true;
-        // Unlock and notify
-        lk.unlock();
-        condVar.notify_one();
-        grabbedFrame.release();
-        ++processedFrameNum;
+// Foreground of the running average background, the first frame seeds it
+struct Capture::BackgroundMask{
+    static constexpr bool needsPrevious = false;
+    static void seed(Capture& c){
+        c.backgroundSubtraction(&c.motionMask, c.croppedFrame);
     }
-    active = false;
-    condVar.notify_one(); // To unlock the scene while loop
-}
+    static bool run(Capture& c){
+        c.backgroundSubtraction(&c.motionMask, c.croppedFrame);
+        return true;
+    }
+};
 
-void Capture::preProcessing(cv::Mat* f)const{
-     // Crop the frame in order to consider just the playground
-    (*f) = (*f)(cv::Range(cropCoords[0], cropCoords[1]), cv::Range(cropCoords[2], cropCoords[3]));
+struct Capture::NoSpeed{
+    static constexpr bool enabled = false;
+    static constexpr bool needsPrevious = false;
+};
 
-    //Resize the frame for faster analysis
-    cv::resize(*f, *f, cv::Size(150, (f->rows/(double)f->cols)*150), cv::INTER_AREA);
-    
-    // Pre-processing
-    cvtColor(*f, *f, cv::COLOR_BGR2GRAY); //gray scale
-    GaussianBlur(*f, *f, cv::Size(5,5), 0.3); //gussian blur
-}
-
-void Capture::frameDifferencing(cv::Mat* dst, cv::Mat* f1, cv::Mat* f2)const{
-    cv::absdiff(*f1, *f2, *dst);
-    // make the areas bigger
-    dilate(*dst, *dst, cv::getStructuringElement( cv::MORPH_ELLIPSE,
-                cv::Size( 2*DILATE_SIZE + 1, 2*DILATE_SIZE+1 ),
-                cv::Point(DILATE_SIZE, DILATE_SIZE))); // DILATE_SIZE depends on the resolution of the frame
-    //Threshold (black and white)
-    threshold(*dst, *dst, 20, 255, cv::THRESH_BINARY);
-}
-
-double Capture::getArea(const std::vector<std::vector<cv::Point>>& contours){
-    // Calculate the area
-    double totalArea = 0;
-    for(int i = 0; i < contours.size(); i++){
-        double a = contourArea(contours[i]);
-        if (a < 10){ // Do not include obj with a small area
-            continue;
+// Mean speed of the blobs: tracking and Lucas-Kanade between the previous frame and the current one
+struct Capture::LucasKanadeSpeed{
+    static constexpr bool enabled = true;
+    static constexpr bool needsPrevious = true;
+    static double run(Capture& c){
+        return c.getAvgSpeed(c.croppedFrame, c.previousFrame, c.blobs);
+    }
+    static void nextFrame(Capture& c){
+        c.flowTracker.nextFrame(); // the pyramid and the blobs of this frame are the previous ones of the next frame (none if skipped)
+    }
+};
+
+// area*weight
+struct Capture::AreaFold{
+    static constexpr bool usesAlpha = false;
+    template<bool AlphaZero> static double score(const FrameSlot& s, const int weight){
+        return s.area*weight;
+    }
+};
+
+// area*weight*n^alpha, n = number of areas
+struct Capture::AreaCountFold{
+    static constexpr bool usesAlpha = true;
+    template<bool AlphaZero> static double score(const FrameSlot& s, const int weight){
+        if constexpr(AlphaZero) return s.area*weight;
+        else return s.area*weight*std::pow(s.area_n, alpha);
+    }
+};
+
+// area*speed*weight*n^alpha
+struct Capture::AreaSpeedCountFold{
+    static constexpr bool usesAlpha = true;
+    template<bool AlphaZero> static double score(const FrameSlot& s, const int weight){
+        if constexpr(AlphaZero) return s.area*s.vel*weight;
+        else return s.area*s.vel*weight*std::pow(s.area_n, alpha);
+    }
+};
+
+template<typename Mask, typename Speed, typename Fold, bool AlphaZero, bool Debug>
+TaskStatus Capture::scoringStep(){
+    TRACE_SCOPE(&trace, "step");
+    // The frame of the previous step may still be waiting for a free slot
+    TaskStatus status = deliver();
+    if(status != TASK_PROGRESS) return status;
+    if(!isOpened()) return finish();
+    status = pace(); // realtime ingest: wait for the frame to be due
+    if(status != TASK_PROGRESS) return status;
+
+    const AllocCount allocStart = AllocCounter::thisThread();
+    if(!decodeFrame()) return finish();
+    constexpr bool needsPrevious = Mask::needsPrevious || Speed::needsPrevious;
+    const unsigned int frameNum = processedFrameNum + 1;
+    const bool analyze = frameNum > 0 && (strideShadow || frameNum % analysisStride == 0);
+    // The next analyzed frame is compared with this one, or this one seeds the model
+    const bool keep = analyze || (needsPrevious ? strideShadow || (frameNum + 1) % analysisStride == 0 : frameNum == 0);
+
+    auto analysisStart = std::chrono::steady_clock::now();
+    if(keep) preProcessing(originalFrame, &croppedFrame);
+
+    // Check if a stop signal has arrived
+    if(stopSignalReceived) return finish();
+
+    if(frameNum > 0) {
+        FrameSlot& slot = pendingSlot;
+        if(analyze){
+            if(Mask::run(*this)){
+                TRACE_SCOPE(&trace, "blobs");
+                blobExtractor.run(motionMask, MIN_BLOB_AREA, blobs, stripes, parallelFor);
+            }
+            slot.area_n = blobs.size();
+            //Check whether blobs.size is greater than 0 before performing the calculation
+            if(slot.area_n > 0){
+                slot.area = getArea(blobs);
+                if constexpr(Speed::enabled) slot.vel = Speed::run(*this);
+                slot.score = Fold::template score<AlphaZero>(slot, weight); // calculate the weighted score
+            }
+            if constexpr(Debug){
+                if(isdisplayAnalysis) displayAnalysis(motionMask, croppedFrame, blobs, slot.score, slot.area, slot.vel);
+            }
         }
-        totalArea += a;
+        countAnalysis(analysisStart, analyze);
+        applyStride(slot, frameNum);
+        slot.frameNum = frameNum;
+        slot.frame = originalFrame; // the scene gets the pooled buffer, no copy
+        hasPending = true;
+    } else {
+        if(keep) Mask::seed(*this);
+        countAnalysis(analysisStart, false);
+    }
+
+    if constexpr(Speed::enabled) Speed::nextFrame(*this);
+    if constexpr(needsPrevious){
+        if(keep) cv::swap(previousFrame, croppedFrame); // Save the previous frame, its buffer is reused for the next one
     }
-    return totalArea;
+    originalFrame.release(); // drop our reference, the buffer goes back to the pool once the scene is done
+    ++processedFrameNum;
+
+    // Hand the frame over to the scene, retried in the next steps if the ring is full
+    status = deliver();
+    countAllocations(allocStart, frameNum);
+    return status;
 }
 
-double Capture::getAvgSpeed(const cv::Mat& currFrameGray, const cv::Mat& prevFrameGray, const std::vector<std::vector<cv::Point>>& contours){
+template<typename Mask, typename Speed, typename Fold>
+ScoringMethod Capture::compose(){
+    ScoringMethod m;
+    // alpha is only read by the folds that use it: the others get the alpha == 0 loop in both cases
+    m.steps[0][0] = &Capture::scoringStep<Mask, Speed, Fold, true, false>;
+    m.steps[0][1] = &Capture::scoringStep<Mask, Speed, Fold, true, true>;
+    m.steps[1][0] = &Capture::scoringStep<Mask, Speed, Fold, !Fold::usesAlpha, false>;
+    m.steps[1][1] = &Capture::scoringStep<Mask, Speed, Fold, !Fold::usesAlpha, true>;
+    return m;
+}
 
-    if(contours.size() == 0) return 0;
+const std::map<std::string_view, ScoringMethod>& Capture::scoringMethods(){
+    // method= in the config file
+    static const std::map<std::string_view, ScoringMethod> methods = {
+        {"FrameDiffAreaAndVel", compose<FrameDifferenceMask, LucasKanadeSpeed, AreaSpeedCountFold>()},
+        {"FrameDiffAreaOnly", compose<FrameDifferenceMask, NoSpeed, AreaFold>()},
+        {"BackgroundModelArea", compose<BackgroundMask, NoSpeed, AreaCountFold>()}
+    };
+    return methods;
+}
 
-    std::vector<cv::Moments> m; //Moments
-    for(const auto& contour : contours){
-        m.push_back(cv::moments(contour, true));
+CaptureStep ScoringMethod::select(const bool debugView)const{
+    return steps[Capture::alpha != 0][debugView];
+}
+
+void Capture::applyStride(FrameSlot& slot, const unsigned int frameNum){
+    if(strideShadow) slot.fullScore = slot.score; // what the full rate analysis would hand to the scene
+    if(analysisStride == 1) return;
+    // Only the frames on the stride count, in shadow mode the others have been analyzed just for the comparison
+    if(frameNum % analysisStride == 0){
+        strideBefore = strideLast;
+        strideLast = slot;
     }
+    double t = 1; // STRIDE_HOLD: the last analyzed values until the next analyzed frame
+    // STRIDE_INTERPOLATE: ramp from the previous analyzed values to the last ones over the stride (one stride of lag)
+    if(strideMode == STRIDE_INTERPOLATE) t = (frameNum % analysisStride + 1)/(double)analysisStride;
+    slot.score = strideBefore.score + (strideLast.score - strideBefore.score)*t;
+    slot.area = strideBefore.area + (strideLast.area - strideBefore.area)*t;
+    slot.vel = strideBefore.vel + (strideLast.vel - strideBefore.vel)*t;
+    slot.area_n = strideLast.area_n;
+}
 
-    std::vector<cv::Point2f> mc; //Centroids
-    for(const auto& moment : m){
-        mc.push_back(cv::Point2f( moment.m10/moment.m00 , moment.m01/moment.m00 ));
+TaskStatus Capture::grabFrame(){
+    TRACE_SCOPE(&trace, "step");
+    // The frame of the previous step may still be waiting for a free slot
+    TaskStatus status = deliver();
+    if(status != TASK_PROGRESS) return status;
+    if(!isOpened()) return finish();
+    status = pace(); // realtime ingest: wait for the frame to be due
+    if(status != TASK_PROGRESS) return status;
+
+    const AllocCount allocStart = AllocCounter::thisThread();
+    {
+        TRACE_SCOPE(&trace, "grab");
+        ALLOC_FOREIGN_SCOPE();
+        if(!grab()) return finish(); // demux only, keeps the stream in sync
     }
+    framePool.traffic.countFrame();
+    
+    // Check if a stop signal has arrived
+    if(stopSignalReceived) return finish();
 
-    // Optical Flow Lucas-Kanade method
-    std::vector<uchar> status;
-    std::vector<float> err;
-    std::vector<cv::Point2f> calcPoints;
-    cv::TermCriteria criteria = cv::TermCriteria((cv::TermCriteria::COUNT) + (cv::TermCriteria::EPS), 10, 0.03);
-    cv::calcOpticalFlowPyrLK(prevFrameGray, currFrameGray, mc, calcPoints, status, err, cv::Size(15,15), 2, criteria);
-
-    std::vector<cv::Point2f> good_new;
-    int good = 0;
-    double speedSum = 0;
-    for(int i = 0; i < mc.size(); i++){
-        // Select good points
-        if(status[i] == 1) {
-            good++;
-            cv::Point2f diff = mc[i] - calcPoints[i];    
-            speedSum += cv::sqrt((diff.x*diff.x) + (diff.y*diff.y));
-            good_new.push_back(calcPoints[i]);
+    FrameSlot& slot = pendingSlot;
+    slot.frameNum = processedFrameNum + 1;
+    slot.pts = timestamp();
+    slot.captured = realtime ? frameCaptured : std::chrono::steady_clock::now();
+    // Decode only if the frame can end up on air or in the general monitor, otherwise the slot has an empty frame
+    bool decode = !lazyDecode || scoreboard->decodeWanted(boardIndex) || (decodeInterval > 0 && slot.frameNum % decodeInterval == 0);
+    if(decode){
+        TRACE_SCOPE(&trace, "retrieve");
+        originalFrame = framePool.acquire(); // decode straight into a pooled buffer
+        {
+            ALLOC_FOREIGN_SCOPE();
+            if(!retrieve(originalFrame)) return finish();
         }
+        framePool.adopt(originalFrame);
+        framePool.traffic.countCopy(originalFrame); // the decoder converts its picture into the pooled buffer
+        stats.decodedFrames.fetch_add(1, std::memory_order_relaxed);
+        slot.frame = originalFrame; // the scene gets the pooled buffer, no copy
+        originalFrame.release();
+    } else stats.skippedFrames.fetch_add(1, std::memory_order_relaxed);
+    hasPending = true;
+    ++processedFrameNum;
+
+    // Hand the frame over to the scene, retried in the next steps if the ring is full
+    status = deliver();
+    countAllocations(allocStart, processedFrameNum); // the slot has been reset if the ring took it
+    return status;
+}
+
+void Capture::preProcessing(const cv::Mat& src, cv::Mat* f){
+    TRACE_SCOPE(&trace, "preprocess");
+     // Crop the frame in order to consider just the playground (no copy, it is a view on src)
+    cv::Mat cropped = src(cv::Range(cropCoords[0], cropCoords[1]), cv::Range(cropCoords[2], cropCoords[3]));
+
+    // Resize to a width of 150 for faster analysis, gray scale and gaussian blur in a single pass
+    if(cropped.size() != preprocessKernel.inputSize()){
+        preprocessKernel.plan(cropped.size(), 150, 0.3);
+        reserveScratch(preprocessKernel.outputSize());
     }
-    return (speedSum/good)*100; // *100 to avoid sub 1 values
+    preprocessKernel.run(cropped, *f, stripes, parallelFor);
 }
 
-void Capture::displayAnalysis(const cv::Mat& diffFrame, const cv::Mat& croppedFrame, const std::vector<std::vector<cv::Point>>& contours, const double area, const double avgVel){
-    std::string winName = capName + " ANALYSIS - for DEBUGGING purposes ONLY";
-    cv::namedWindow(winName, cv::WINDOW_AUTOSIZE);
-    cv::waitKey(1);
-    if(!getWindowProperty(winName, cv::WND_PROP_VISIBLE)) isdisplayAnalysis = false;
-    else{
-        
-        // Concatenate the two frames 
-        cv::Mat out;
-        cv::hconcat(croppedFrame, diffFrame, out);
-        cv::cvtColor(out, out, cv::COLOR_GRAY2BGR);
-        drawContours(out, contours, -1, cv::Scalar(0, 255, 0), 1);
-        cv::resize(out, out, cv::Size(1200, (out.rows/(double)out.cols)*1200));
-
-        //Update values to display every 15 frames -> so you can read
-        if(!(processedFrameNum%15)){
-            paramToDisplay["FINAL_SCORE"] = std::to_string((int)std::floor(score));
-            paramToDisplay["AREAS_NUM"] = std::to_string((int)contours.size());
-            paramToDisplay["AVG_SPEED"] = std::to_string((int)avgVel);
-            paramToDisplay["AREA"] = std::to_string((int)area);
-            paramToDisplay["WEIGHT"] = std::to_string(weight);
-        }
-        // Insert some labels
-        int i = 0;
-        for(const auto& [key, val] : paramToDisplay){
-            cv::putText(out, //target image
-                key + ": " + val, //text
-                cv::Point(5, 30*(1 + i++)),
-                cv::FONT_HERSHEY_PLAIN,
-                1.5,
-                CV_RGB(0, 0, 255), //font color
-                1);
-        }
-        if(processedFrameNum == 0)analysisOut = cv::VideoWriter("../out/" + capName + "_Analysis.mp4", cv::VideoWriter::fourcc('m','p','4','v'),25, cv::Size(out.cols, out.rows));
-        analysisOut.write(out);
-        cv::imshow(winName, out);
+bool Capture::gateFrame(){
+    if(gateThreshold <= 0) return true;
+    TRACE_SCOPE(&trace, "gate");
+    // Block SAD of the preprocessed frames: the motion mask is computed only where some tile changed
+    const int changed = motionGate.run(previousFrame, croppedFrame, gateThreshold);
+    stats.gateTiles.fetch_add(motionGate.tileCount(), std::memory_order_relaxed);
+    stats.gatedTiles.fetch_add(motionGate.tileCount() - changed, std::memory_order_relaxed);
+    if(changed > 0) return true;
+    stats.gatedFrames.fetch_add(1, std::memory_order_relaxed);
+    motionMask.create(croppedFrame.rows, croppedFrame.cols);
+    std::fill(motionMask.bits.begin(), motionMask.bits.end(), 0); // empty mask for the debug view
+    blobs.clear();
+    return false;
+}
+
+void Capture::frameDifferencing(BinaryMask* dst, cv::Mat* f1, cv::Mat* f2){
+    TRACE_SCOPE(&trace, "diff");
+    // Difference, threshold (black and white) and dilation to make the areas bigger, in a single fused pass
+    motionKernel.run(*f1, *f2, 20, *dst, stripes, parallelFor, gateThreshold > 0 ? &motionGate : nullptr);
+}
+
+void Capture::backgroundSubtraction(BinaryMask* dst, const cv::Mat& f){
+    TRACE_SCOPE(&trace, "background");
+    // Foreground of the running average, dilated like the frame difference so that the blobs compare
+    backgroundModel.run(f, 20, foregroundMask, stripes, parallelFor);
+    motionKernel.dilate(foregroundMask, *dst, stripes, parallelFor);
+}
+
+void Capture::countAnalysis(const std::chrono::steady_clock::time_point start, const bool analyzed){
+    if(analyzed) stats.analyzedFrames.fetch_add(1, std::memory_order_relaxed);
+    stats.analysisNs.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+}
+
+void Capture::countAllocations(const AllocCount& start, const unsigned int frameNum){
+    // The first frames size the scratch buffers of the stages: only the steady state counts
+    if(!AllocCounter::enabled() || frameNum < ALLOC_WARMUP_FRAMES) return;
+    const AllocCount now = AllocCounter::thisThread();
+    const unsigned long long own = now.own - start.own;
+    stats.steadyFrames.fetch_add(1, std::memory_order_relaxed);
+    stats.steadyAllocations.fetch_add(own, std::memory_order_relaxed);
+    if(own > 0) stats.allocatingFrames.fetch_add(1, std::memory_order_relaxed);
+    stats.foreignAllocations.fetch_add(now.foreign - start.foreign, std::memory_order_relaxed);
+}
+
+void Capture::reserveScratch(const cv::Size analyzed){
+    // The blobs, their tracks and the runs they come from grow with the content of the frame: room for the
+    // worst case mask, so that a busier frame later in the run does not allocate
+    const int maxBlobs = blobExtractor.reserve(analyzed, stripes);
+    blobs.reserve(maxBlobs);
+    flowTracker.reserve(maxBlobs);
+}
+
+double Capture::getArea(const BlobStats& blobs){
+    // The blobs smaller than MIN_BLOB_AREA are already left out by the extractor
+    return blobs.totalArea;
+}
+
+double Capture::getAvgSpeed(const cv::Mat& currFrameGray, const cv::Mat& prevFrameGray, const BlobStats& blobs){
+
+    if(blobs.size() == 0) return 0;
+    TRACE_SCOPE(&trace, "speed");
+
+    // Blob tracking and Lucas-Kanade on the cached pyramids
+    return flowTracker.avgSpeed(currFrameGray, prevFrameGray, blobs);
+}
+
+void Capture::displayAnalysis(const BinaryMask& diffMask, const cv::Mat& croppedFrame, const BlobStats& blobs, const double score, const double area, const double avgVel){
+    TRACE_SCOPE(&trace, "debugView");
+    // The window has been closed
+    if(!debugSink->isRunning()){
+        isdisplayAnalysis = false;
+        return;
     }
-}
\ No newline at end of file
+    // Copy what the sink needs: the buffers of the analysis are reused by the next frame
+    croppedFrame.copyTo(debugSnapshot.gray);
+    debugSnapshot.mask = diffMask;
+    debugSnapshot.box = blobs.box;
+    debugSnapshot.centroid = blobs.centroid;
+    debugSnapshot.score = score;
+    debugSnapshot.area = area;
+    debugSnapshot.vel = avgVel;
+    debugSnapshot.weight = weight;
+    debugSnapshot.frameNum = processedFrameNum + 1;
+    debugSink->submit(debugSnapshot); // dropped if the sink is still drawing the previous ones
+}
@@ -4,49 +4,187 @@
 #include <opencv2/opencv.hpp>
 #include <string.h>
 #include <iostream>
-#include <mutex>
-#include <condition_variable>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <map>
+#include <string_view>
+#include "frameRing.h"
+#include "framePool.h"
+#include "preprocessKernel.h"
+#include "motionGate.h"
+#include "motionKernel.h"
+#include "blobExtractor.h"
+#include "backgroundModel.h"
+#include "flowTracker.h"
+#include "taskScheduler.h"
+#include "trace.h"
+#include "debugSink.h"
+#include "allocCounter.h"
+#include "scoreboard.h"
 
-#define DILATE_SIZE 2
+#define MIN_BLOB_AREA 10 // blobs with a smaller area are not included in the total area
+#define DEFAULT_SOURCE_FPS 25 // pace of a realtime source that does not report its frame rate
+#define ALLOC_WARMUP_FRAMES 25 // frames the scratch buffers may still grow in, the allocations are counted after them
+
+// Frame handed from a Capture thread to the Scene together with its analysis results
+struct FrameSlot{
+    cv::Mat frame;
+    unsigned int frameNum = 0;
+    double score = 0;
+    double area = 0;
+    double vel = 0;
+    int area_n = 0;
+    double fullScore = -1; // with Capture::strideShadow, the score of the full rate analysis
+    double pts = -1; // presentation timestamp (ms), -1 if the source does not provide it
+    bool stale = false; // set by the scene: the camera missed the tick and the previous frame is reused
+    std::chrono::steady_clock::time_point captured; // when the frame became available (realtime: its due time), carried to the encoder
+};
+
+// Values handed to the scene for the frames skipped by the analysis stride
+typedef enum StrideMode{
+    STRIDE_HOLD = 0,       // the values of the last analyzed frame
+    STRIDE_INTERPOLATE = 1 // ramp between the last two analyzed frames, one stride late
+}StrideMode;
+
+// Per camera counters, written by the capture thread and read by the scene
+struct CaptureStats{
+    alignas(64) std::atomic<unsigned long long> decodedFrames{0};
+    std::atomic<unsigned long long> skippedFrames{0}; // grabbed but never decoded (lazy decode)
+    std::atomic<unsigned long long> analyzedFrames{0};
+    std::atomic<unsigned long long> analysisNs{0}; // preprocessing, frame differencing and blob extraction
+    std::atomic<unsigned long long> ringFullBackoffs{0}; // steps that found the ring full
+    std::atomic<unsigned long long> gatedFrames{0}; // analyzed frames without any changed tile, scored 0 right away
+    std::atomic<unsigned long long> gateTiles{0}; // tiles checked by the motion gate
+    std::atomic<unsigned long long> gatedTiles{0}; // tiles left out of the frame differencing
+    std::atomic<unsigned long long> injectedDrops{0}; // realtime ingest: frames the emulated live source never delivered
+    // MULTICAMSWITCH_ALLOC_COUNTING: heap allocations of the steps after ALLOC_WARMUP_FRAMES
+    std::atomic<unsigned long long> steadyFrames{0};
+    std::atomic<unsigned long long> steadyAllocations{0}; // by our code, 0 once the scratch buffers are warm
+    std::atomic<unsigned long long> allocatingFrames{0}; // steady state frames with at least one of them
+    std::atomic<unsigned long long> foreignAllocations{0}; // by the decoder and OpenCV
+    // Written by the scene, on their own cache line
+    alignas(64) std::atomic<unsigned long long> gatherWaitNs{0}; // time the scene waited for the frames of this camera
+    std::atomic<unsigned long long> stalls{0}; // ticks the camera missed the gather deadline
+    std::atomic<unsigned long long> substitutions{0}; // ticks served with the previous frame (stall or frame ahead of the tick)
+    std::atomic<unsigned long long> alignDrops{0}; // frames dropped by the scene to catch up with the tick
+    double meanAnalysisMs()const;
+};
+
+class Capture;
+typedef TaskStatus (Capture::*CaptureStep)();
+
+// A scoring method of the registry (method= in the config file): the capture step compiled for every combination
+// of the runtime switches, so that the common case (alpha == 0, no debug view) runs a loop without them
+struct ScoringMethod{
+    CaptureStep steps[2][2]; // [alpha != 0][debug view]
+    CaptureStep select(const bool debugView)const; // reads Capture::alpha, call it once the config is read
+};
 
 class Capture : public cv::VideoCapture{
+    friend class KernelBench; // bench/kernelBench.cpp measures the private stages
 private:
     unsigned int processedFrameNum;
     double ratio;
     int cropCoords[4];
-    std::map<std::string, std::string> paramToDisplay;
+    bool cropSet; // [CROP_COORDS] given, otherwise the whole frame once the source is probed
     bool isdisplayAnalysis;
-    double getArea(const std::vector<std::vector<cv::Point>>& contours);
-    double getAvgSpeed(const cv::Mat& currFrameGray, const cv::Mat& prevFrameGray, const std::vector<std::vector<cv::Point>>& contours);
-    void displayAnalysis(const cv::Mat& diffFrame, const cv::Mat& croppedFrame, const std::vector<std::vector<cv::Point>>& contours, const double area, const double avgVel);
-    void preProcessing(cv::Mat* f)const;
-    void frameDifferencing(cv::Mat* dst, cv::Mat* f1, cv::Mat* f2)const;
-    cv::VideoWriter analysisOut;
+    bool lazyDecode; // grab() every frame but retrieve() only the ones the scene needs
+    int decodeInterval; // with lazyDecode, also decode one frame every decodeInterval (0 = never)
+    double getArea(const BlobStats& blobs);
+    double getAvgSpeed(const cv::Mat& currFrameGray, const cv::Mat& prevFrameGray, const BlobStats& blobs);
+    void displayAnalysis(const BinaryMask& diffMask, const cv::Mat& croppedFrame, const BlobStats& blobs, const double score, const double area, const double avgVel);
+    void preProcessing(const cv::Mat& src, cv::Mat* f);
+    bool gateFrame(); // false if nothing changed since the previous frame: no motion, no blobs
+    void frameDifferencing(BinaryMask* dst, cv::Mat* f1, cv::Mat* f2); // only the changed tiles after gateFrame()
+    void backgroundSubtraction(BinaryMask* dst, const cv::Mat& f); // foreground of f, then f is learned
+    std::unique_ptr<DebugSink> debugSink; // [DISPLAY_ANALYSIS] view, drawn on its own thread
+    DebugSnapshot debugSnapshot;
+    PreprocessKernel preprocessKernel; // fused crop/resize/gray/blur, planned for the crop size
+    MotionGate motionGate; // block SAD change detection, run before the motion kernel
+    MotionKernel motionKernel; // fused absdiff/threshold/dilate
+    BackgroundModel backgroundModel; // running average of the analyzed frames (BackgroundModelArea)
+    BinaryMask foregroundMask; // foreground before the dilation
+    BinaryMask motionMask; // packed motion mask of the last analyzed frame
+    BlobExtractor blobExtractor;
+    BlobStats blobs; // blobs of motionMask, reused frame after frame
+    // State kept between two steps of the capture task
+    cv::Mat originalFrame, croppedFrame, previousFrame;
+    FrameSlot pendingSlot; // analyzed frame not yet accepted by the ring
+    bool hasPending;
+    int stripes; // horizontal stripes the analysis of a frame is split in
+    ParallelFor parallelFor; // runs the stripes
+    unsigned int analysisStride; // analyze one frame every analysisStride
+    FrameSlot strideLast, strideBefore; // values of the last two analyzed frames (no frame)
+    void applyStride(FrameSlot& slot, const unsigned int frameNum);
+    bool realtime; // emulate a live camera: a frame is available only from its due time on
+    double sourceFps;
+    double ingestJitterMs; // realtime: each frame arrives up to ingestJitterMs late
+    double ingestDropRate; // realtime: fraction of the frames lost on the way
+    std::mt19937 ingestRng;
+    std::chrono::steady_clock::time_point nominalDue; // due time of the next frame without jitter
+    std::chrono::steady_clock::time_point nextArrival; // when the next frame can be read
+    std::chrono::steady_clock::time_point frameCaptured; // arrival time of the frame being read
+    TaskStatus pace();
+    bool decodeFrame(); // read the next frame into a pooled buffer
+    double timestamp(); // CAP_PROP_POS_MSEC of the last grabbed frame, -1 if unknown
+    TaskStatus deliver();
+    void countAnalysis(const std::chrono::steady_clock::time_point start, const bool analyzed);
+    void countAllocations(const AllocCount& start, const unsigned int frameNum);
+    void reserveScratch(const cv::Size analyzed); // worst case room in the per frame buffers of the stages
+    TaskStatus finish();
+    Scoreboard* scoreboard; // the values of the delivered frames and the end of the stream are published here
+    int boardIndex; // line of this camera
+    FlowTracker flowTracker; // pyramids and blob tracks kept between frames
+    // Scoring stages, defined in capture.cpp. Mask: motionMask of croppedFrame; Speed: mean speed of the blobs;
+    // Fold: the score from the values of the slot
+    struct FrameDifferenceMask;
+    struct BackgroundMask;
+    struct NoSpeed;
+    struct LucasKanadeSpeed;
+    struct AreaFold;
+    struct AreaCountFold;
+    struct AreaSpeedCountFold;
+    // One frame through the stages, the same loop for every scoring method
+    template<typename Mask, typename Speed, typename Fold, bool AlphaZero, bool Debug> TaskStatus scoringStep();
+    template<typename Mask, typename Speed, typename Fold> static ScoringMethod compose();
 public:
     static bool stopSignalReceived;
     static double alpha;
+    static StrideMode strideMode;
+    static bool strideShadow; // analyze every frame anyway, to compare the strided scores with the full rate ones
+    static double gateThreshold; // mean absolute difference a tile needs to be differenced, 0 = no motion gate
     std::string capName;
     std::string source;
-    cv::Mat frame;
     bool analysis; // If the score will be calculated
     int weight;
-    int area_n;
-    double score;
-    double area;
-    double vel;
-    bool active;
-    bool readyToRetrieve;
-    std::mutex mx;
-    std::condition_variable condVar;
-    Capture(std::string _capName, std::string _source, bool _analysis);
+    FrameRing<FrameSlot> ring; // frames and scores waiting to be retrieved by the scene
+    FramePool framePool; // buffers the frames are decoded into
+    CaptureStats stats;
+    TraceTrack trace; // stage latencies, recorded by the task of this camera
+    double openMs, probeMs; // startup time, written by openSource()
+    Capture(std::string _capName, std::string _source, bool _analysis); // the stream is opened by openSource()
+    void openSource(); // open and probe the stream, throws std::invalid_argument if it cannot be read
     friend std::ostream& operator <<(std::ostream& os, const Capture& cap);
-    void display();
-    void FrameDiffAreaAndVel();
-    void FrameDiffAreaOnly();
-    void grabFrame();
+    // Capture tasks: each call processes one frame and never waits, the steps run on the worker pool
+    TaskStatus display();
+    static const std::map<std::string_view, ScoringMethod>& scoringMethods(); // by method name
+    TaskStatus grabFrame();
     void setCrop(const int cropArray[]);
     void setWeight(const int w);
-    void setDisplayAnalysis(const bool da);
+    void setDisplayAnalysis(const bool da); // the view is opened by startDebugView()
+    void startDebugView(); // with [DISPLAY_ANALYSIS], open the view and start its thread, before the analysis task starts
+    void setRing(const int depth, const OverflowPolicy policy);
+    void setScoreboard(Scoreboard* board, const int index); // before the task starts
+    void setLazyDecode(const bool lazy, const int interval);
+    void setIncrementalFlow(const bool inc);
+    void setAnalysisStride(const int n);
+    void setBackgroundFrames(const int n); // time constant of the background model, a power of two
+    void setRealtime(const bool rt, const double jitterMs, const double dropRate);
+    double frameRate()const; // native frame rate of the source
+    void setStripes(const int n, const ParallelFor& pf);
+    const FlowStats& flowStats()const;
+    const DebugSink* debugView()const; // nullptr without [DISPLAY_ANALYSIS]
     bool operator==(const Capture& cap)const;
 };
 #endif
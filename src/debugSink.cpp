@@ -0,0 +1,115 @@
+#include "debugSink.h"
+#include <cmath>
+#include <cstdio>
+#include "trace.h"
+
+DebugSink::DebugSink(const std::string& _capName){
+    capName = _capName;
+    winName = capName + " ANALYSIS - for DEBUGGING purposes ONLY";
+    // A full queue leaves the snapshot with the capture (dropped), so that its buffers are not lost
+    queue.reset(DEBUG_SINK_DEPTH, OVERFLOW_BLOCK);
+    spares.reset(DEBUG_SINK_DEPTH + 2, OVERFLOW_DROP_NEWEST); // every snapshot in flight fits
+    running = false;
+    drawn = 0;
+    dropped = 0;
+    labels = {"AREA: 0", "AREAS_NUM: 0", "AVG_SPEED: 0", "FINAL_SCORE: 0", "WEIGHT: 0"};
+}
+
+DebugSink::~DebugSink(){
+    close();
+}
+
+void DebugSink::start(){
+    if(worker.joinable()) return;
+    running = true;
+    worker = std::thread(&DebugSink::run, this);
+}
+
+bool DebugSink::submit(DebugSnapshot& snapshot){
+    if(!running.load(std::memory_order_relaxed)) return false;
+    const PushResult pushed = queue.tryPush(snapshot);
+    if(pushed != PUSH_OK){
+        if(pushed == PUSH_FULL) dropped++; // still drawing: the capture overwrites the snapshot with the next frame
+        return false;
+    }
+    spares.tryPop(snapshot); // empty until the first snapshots come back
+    return true;
+}
+
+void DebugSink::close(){
+    if(!worker.joinable()) return;
+    queue.close();
+    worker.join();
+}
+
+bool DebugSink::isRunning()const{
+    return running.load(std::memory_order_relaxed);
+}
+
+void DebugSink::run(){
+    TRACE_THREAD_NAME("DEBUG " + capName);
+    // HighGUI windows belong to the thread that creates them
+    cv::namedWindow(winName, cv::WINDOW_AUTOSIZE);
+    DebugSnapshot snapshot;
+    while(queue.pop(snapshot)){
+        draw(snapshot);
+        spares.tryPush(snapshot); // back to the capture
+        cv::waitKey(1);
+        if(!cv::getWindowProperty(winName, cv::WND_PROP_VISIBLE)) break; // window closed: stop the debug view
+    }
+    running = false;
+    while(queue.tryPop(snapshot));
+    out.release();
+    cv::destroyWindow(winName);
+}
+
+static void setLabel(std::string& label, const char* key, const long long value){
+    char text[64];
+    std::snprintf(text, sizeof(text), "%s: %lld", key, value);
+    label.assign(text); // keeps the capacity of the label
+}
+
+void DebugSink::draw(const DebugSnapshot& s){
+    TRACE_SCOPE(nullptr, "debugDraw");
+    // Concatenate the two frames, the mask is unpacked only here
+    s.mask.toMat(diffFrame);
+    cv::hconcat(s.gray, diffFrame, concat);
+    cv::cvtColor(concat, view, cv::COLOR_GRAY2BGR);
+    // Bounding box and centroid of each blob, on both halves
+    for(int i = 0; i < s.box.size(); i++){
+        for(int half = 0; half < 2; half++){
+            cv::Point shift(half*s.gray.cols, 0);
+            cv::rectangle(view, s.box[i] + shift, cv::Scalar(0, 255, 0), 1);
+            cv::circle(view, cv::Point(s.centroid[i]) + shift, 1, cv::Scalar(0, 0, 255), -1);
+        }
+    }
+    cv::resize(view, resized, cv::Size(1200, (view.rows/(double)view.cols)*1200));
+
+    //Update values to display every 15 frames -> so you can read
+    if(drawn == 0 || !(s.frameNum%15)){
+        setLabel(labels[0], "AREA", (long long)s.area);
+        setLabel(labels[1], "AREAS_NUM", (long long)s.box.size());
+        setLabel(labels[2], "AVG_SPEED", (long long)s.vel);
+        setLabel(labels[3], "FINAL_SCORE", (long long)std::floor(s.score));
+        setLabel(labels[4], "WEIGHT", s.weight);
+    }
+    // Insert some labels
+    for(int i = 0; i < labels.size(); i++){
+        cv::putText(resized, //target image
+            labels[i], //text
+            cv::Point(5, 30*(1 + i)),
+            cv::FONT_HERSHEY_PLAIN,
+            1.5,
+            CV_RGB(0, 0, 255), //font color
+            1);
+    }
+    if(!out.isOpened()) out = cv::VideoWriter("../out/" + capName + "_Analysis.mp4", cv::VideoWriter::fourcc('m','p','4','v'),25, cv::Size(resized.cols, resized.rows));
+    out.write(resized);
+    cv::imshow(winName, resized);
+    drawn++;
+}
+
+std::ostream& operator <<(std::ostream& os, const DebugSink& sink){
+    os << sink.capName << " debug view: " << sink.drawn << " frames drawn, " << sink.dropped << " dropped";
+    return os;
+}
@@ -0,0 +1,56 @@
+#ifndef __DEBUG_SINK__
+#define __DEBUG_SINK__
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "frameRing.h"
+#include "motionKernel.h"
+
+#define DEBUG_SINK_DEPTH 2 // snapshots waiting to be drawn, the newest ones are dropped beyond that
+
+// What the analysis of a frame saw, copied so that the capture can reuse its buffers right away
+struct DebugSnapshot{
+    cv::Mat gray; // preprocessed frame
+    BinaryMask mask; // motion mask
+    std::vector<cv::Rect> box;
+    std::vector<cv::Point2f> centroid;
+    double score = 0;
+    double area = 0;
+    double vel = 0;
+    int weight = 0;
+    unsigned int frameNum = 0;
+};
+
+// Debug view of the analysis of a camera ([DISPLAY_ANALYSIS]): drawn, shown and written to
+// ../out/<camera>_Analysis.mp4 on a thread of its own. The capture only queues snapshots and never
+// waits: when the sink is behind the snapshot is dropped, so the view can stay on without slowing the cameras.
+// The drawn snapshots go back to the capture through the spares ring: their buffers are reused, not reallocated.
+class DebugSink{
+private:
+    std::string capName;
+    std::string winName;
+    FrameRing<DebugSnapshot> queue;
+    FrameRing<DebugSnapshot> spares; // drawn snapshots, refilled by the capture
+    std::thread worker;
+    std::atomic<bool> running;
+    cv::VideoWriter out;
+    cv::Mat diffFrame, concat, view, resized; // drawing buffers, reused frame after frame
+    std::vector<std::string> labels; // "KEY: value" lines shown on the view
+    unsigned long long drawn; // read once the thread is joined
+    unsigned long long dropped; // written by the capture, read once its task is done
+    void run();
+    void draw(const DebugSnapshot& s);
+public:
+    DebugSink(const std::string& _capName);
+    ~DebugSink();
+    void start();
+    bool submit(DebugSnapshot& snapshot); // capture side, never waits; snapshot gets the buffers of a drawn one
+    void close(); // draw the queued snapshots and stop
+    bool isRunning()const; // false once the window has been closed
+    friend std::ostream& operator <<(std::ostream& os, const DebugSink& sink);
+};
+
+#endif
@@ -0,0 +1,112 @@
+#include "flowTracker.h"
+#include <chrono>
+
+double FlowStats::meanMs()const{
+    return frames ? totalMs/frames : 0;
+}
+
+FlowTracker::FlowTracker(){
+    prevBuilt = false;
+    currBuilt = false;
+    prevTracked = false;
+    currTracked = false;
+    incremental = true;
+}
+
+void FlowTracker::setIncremental(const bool inc){
+    incremental = inc;
+}
+
+void FlowTracker::reserve(const int blobs){
+    prevCentroids.reserve(blobs);
+    prevUsed.reserve(blobs);
+    lkPoints.reserve(blobs);
+    lkResult.reserve(blobs);
+    status.reserve(blobs);
+    err.reserve(blobs);
+}
+
+void FlowTracker::buildPyramid(const cv::Mat& gray, std::vector<cv::Mat>& pyramid){
+    // The levels keep their buffers from frame to frame, OpenCV still allocates a few temporaries
+    ALLOC_FOREIGN_SCOPE();
+    cv::buildOpticalFlowPyramid(gray, pyramid, cv::Size(FLOW_WIN_SIZE, FLOW_WIN_SIZE), FLOW_MAX_LEVEL);
+    stats.pyramidsBuilt++;
+}
+
+int FlowTracker::match(const cv::Point2f& centroid, const cv::Rect& box){
+    // Nearest unused blob of the previous frame whose centroid falls in the (slightly enlarged) box of this one
+    cv::Rect area(box.x - DILATE_SIZE, box.y - DILATE_SIZE, box.width + 2*DILATE_SIZE, box.height + 2*DILATE_SIZE);
+    int best = -1;
+    float bestDist = 0;
+    for(int j = 0; j < prevCentroids.size(); j++){
+        const cv::Point2f& p = prevCentroids[j];
+        if(prevUsed[j] || p.x < area.x || p.y < area.y || p.x >= area.x + area.width || p.y >= area.y + area.height) continue;
+        cv::Point2f diff = p - centroid;
+        float dist = diff.x*diff.x + diff.y*diff.y;
+        if(best < 0 || dist < bestDist){
+            best = j;
+            bestDist = dist;
+        }
+    }
+    return best;
+}
+
+double FlowTracker::avgSpeed(const cv::Mat& currFrameGray, const cv::Mat& prevFrameGray, const BlobStats& blobs){
+    auto start = std::chrono::steady_clock::now();
+    stats.frames++;
+    int good = 0;
+    double speedSum = 0;
+
+    // Blobs matched to the previous frame
+    lkPoints.clear();
+    if(incremental && prevTracked) prevUsed.assign(prevCentroids.size(), 0);
+    for(int i = 0; i < blobs.size(); i++){
+        int j = incremental && prevTracked ? match(blobs.centroid[i], blobs.box[i]) : -1;
+        if(j < 0){
+            lkPoints.push_back(blobs.centroid[i]); // new or lost blob
+            continue;
+        }
+        prevUsed[j] = 1;
+        cv::Point2f diff = blobs.centroid[i] - prevCentroids[j];
+        speedSum += cv::sqrt((diff.x*diff.x) + (diff.y*diff.y));
+        good++;
+        stats.trackedPoints++;
+    }
+
+    // Optical Flow Lucas-Kanade method on the other blobs
+    if(lkPoints.size() > 0){
+        if(!prevBuilt) buildPyramid(prevFrameGray, prevPyramid);
+        if(!currBuilt) buildPyramid(currFrameGray, currPyramid);
+        prevBuilt = currBuilt = true;
+        cv::TermCriteria criteria = cv::TermCriteria((cv::TermCriteria::COUNT) + (cv::TermCriteria::EPS), 10, 0.03);
+        ALLOC_FOREIGN_SCOPE(); // copies the pyramid headers into vectors of its own
+        cv::calcOpticalFlowPyrLK(prevPyramid, currPyramid, lkPoints, lkResult, status, err, cv::Size(FLOW_WIN_SIZE, FLOW_WIN_SIZE), FLOW_MAX_LEVEL, criteria);
+        stats.lkPoints += lkPoints.size();
+        for(int i = 0; i < lkPoints.size(); i++){
+            // Select good points
+            if(status[i] == 1) {
+                good++;
+                cv::Point2f diff = lkPoints[i] - lkResult[i];
+                speedSum += cv::sqrt((diff.x*diff.x) + (diff.y*diff.y));
+            }
+        }
+    }
+
+    // The blobs of this frame are the tracks of the next one
+    prevCentroids.assign(blobs.centroid.begin(), blobs.centroid.end());
+    currTracked = true;
+
+    stats.totalMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if(good == 0) return 0; // Lucas-Kanade lost every blob
+    return (speedSum/good)*100; // *100 to avoid sub 1 values
+}
+
+void FlowTracker::nextFrame(){
+    // The current pyramid is the previous one of the next frame
+    std::swap(prevPyramid, currPyramid);
+    prevBuilt = currBuilt;
+    currBuilt = false;
+    // Tracks are valid only between consecutive frames: without blobs in this frame there is nothing to match
+    prevTracked = currTracked;
+    currTracked = false;
+}
@@ -0,0 +1,48 @@
+#ifndef __FLOW_TRACKER__
+#define __FLOW_TRACKER__
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include "blobExtractor.h"
+#include "allocCounter.h"
+
+#define FLOW_WIN_SIZE 15 // Lucas-Kanade window
+#define FLOW_MAX_LEVEL 2 // pyramid levels above the full resolution one
+
+// Cost of the speed stage of a camera, read once the capture thread is done
+struct FlowStats{
+    unsigned long long frames = 0;
+    unsigned long long lkPoints = 0; // centroids tracked with Lucas-Kanade
+    unsigned long long trackedPoints = 0; // centroids matched to the blob of the previous frame
+    unsigned long long pyramidsBuilt = 0;
+    double totalMs = 0;
+    double meanMs()const;
+};
+
+// Average speed of the blobs between two consecutive frames.
+// The pyramid of a frame is built at most once: the current one becomes the previous one of the next frame.
+// With incremental tracking the blobs whose centroid matches a blob of the previous frame take their
+// displacement from the match, Lucas-Kanade runs only on the new blobs and on the ones whose track was lost.
+class FlowTracker{
+private:
+    std::vector<cv::Mat> prevPyramid, currPyramid;
+    bool prevBuilt, currBuilt; // whether the pyramids belong to the previous/current frame
+    std::vector<cv::Point2f> prevCentroids; // blobs of the previous frame
+    bool prevTracked, currTracked; // whether prevCentroids comes from the previous/current frame
+    std::vector<char> prevUsed;
+    std::vector<cv::Point2f> lkPoints, lkResult;
+    std::vector<uchar> status;
+    std::vector<float> err;
+    bool incremental;
+    void buildPyramid(const cv::Mat& gray, std::vector<cv::Mat>& pyramid);
+    int match(const cv::Point2f& centroid, const cv::Rect& box);
+public:
+    FlowStats stats;
+    FlowTracker();
+    void setIncremental(const bool inc);
+    void reserve(const int blobs); // room for the tracks, so that avgSpeed() only allocates inside OpenCV
+    double avgSpeed(const cv::Mat& currFrameGray, const cv::Mat& prevFrameGray, const BlobStats& blobs);
+    void nextFrame(); // rotate the pyramids and the tracks, called once per analyzed frame
+};
+
+#endif
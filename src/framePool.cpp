@@ -0,0 +1,71 @@
+#include "framePool.h"
+
+void FrameTraffic::countFrame(){
+    frames.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FrameTraffic::countCopy(const cv::Mat& m){
+    bytesCopied.fetch_add(m.total()*m.elemSize(), std::memory_order_relaxed);
+}
+
+void FrameTraffic::countAllocation(){
+    buffersAllocated.fetch_add(1, std::memory_order_relaxed);
+}
+
+double FrameTraffic::bytesCopiedPerFrame()const{
+    unsigned long long f = frames.load(std::memory_order_relaxed);
+    return f ? bytesCopied.load(std::memory_order_relaxed)/(double)f : 0;
+}
+
+double FrameTraffic::buffersAllocatedPerFrame()const{
+    unsigned long long f = frames.load(std::memory_order_relaxed);
+    return f ? buffersAllocated.load(std::memory_order_relaxed)/(double)f : 0;
+}
+
+FramePool::FramePool(){
+    bufferType = CV_8UC3;
+}
+
+bool FramePool::isFree(const cv::Mat& buffer){
+    // Only the pool references the buffer. Adding 0 reads the counter atomically.
+    return buffer.u != nullptr && CV_XADD(&buffer.u->refcount, 0) == 1;
+}
+
+void FramePool::preallocate(const int count, const cv::Size size, const int type){
+    bufferSize = size;
+    bufferType = type;
+    buffers.clear();
+    for(int i = 0; i < count; i++) buffers.push_back(cv::Mat(size, type));
+}
+
+cv::Mat FramePool::acquire(){
+    for(const auto& buffer : buffers){
+        if(isFree(buffer)) return buffer; // shallow copy: the caller shares the pooled buffer
+    }
+    // Every buffer is still in use somewhere down the pipeline: grow the pool
+    traffic.countAllocation();
+    buffers.push_back(cv::Mat(bufferSize, bufferType));
+    return buffers.back();
+}
+
+void FramePool::adopt(const cv::Mat& frame){
+    // The frame has been written in a buffer taken from the pool: nothing to do
+    for(const auto& buffer : buffers){
+        if(buffer.u == frame.u) return;
+    }
+    // The producer had to reallocate it (e.g. the stream changed resolution): keep the new buffer from now on
+    traffic.countAllocation();
+    bufferSize = frame.size();
+    bufferType = frame.type();
+    for(auto& buffer : buffers){
+        if(isFree(buffer) || buffer.size() != bufferSize){
+            buffer = frame;
+            return;
+        }
+    }
+    buffers.push_back(frame);
+}
+
+size_t FramePool::size()const{
+    return buffers.size();
+}
@@ -0,0 +1,40 @@
+#ifndef __FRAME_POOL__
+#define __FRAME_POOL__
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <vector>
+
+// Memory traffic of the frames, reported per processed frame
+struct FrameTraffic{
+    std::atomic<unsigned long long> frames{0};
+    std::atomic<unsigned long long> bytesCopied{0};
+    std::atomic<unsigned long long> buffersAllocated{0};
+    void countFrame();
+    void countCopy(const cv::Mat& m);
+    void countAllocation();
+    double bytesCopiedPerFrame()const;
+    double buffersAllocatedPerFrame()const;
+};
+
+// Pool of preallocated frame buffers.
+// A frame taken from the pool is an ordinary cv::Mat header sharing the pooled buffer, so it can be
+// passed by value from the capture to the encoder without copying the pixels. The buffer is reused as
+// soon as every consumer has dropped its header (the pool's reference is the only one left).
+// acquire() and adopt() must be called by a single thread, the owner of the pool.
+class FramePool{
+private:
+    std::vector<cv::Mat> buffers;
+    cv::Size bufferSize;
+    int bufferType;
+    static bool isFree(const cv::Mat& buffer);
+public:
+    FrameTraffic traffic;
+    FramePool();
+    void preallocate(const int count, const cv::Size size, const int type);
+    cv::Mat acquire();
+    void adopt(const cv::Mat& frame);
+    size_t size()const;
+};
+
+#endif
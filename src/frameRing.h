@@ -0,0 +1,251 @@
+#ifndef __FRAME_RING__
+#define __FRAME_RING__
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+
+// What happens when a producer pushes into a full ring
+typedef enum OverflowPolicy{
+    OVERFLOW_BLOCK = 0,       // wait until the consumer frees a slot
+    OVERFLOW_DROP_OLDEST = 1, // discard the oldest queued element
+    OVERFLOW_DROP_NEWEST = 2  // discard the element being pushed
+}OverflowPolicy;
+
+// Outcome of a push
+typedef enum PushResult{
+    PUSH_OK = 0,      // enqueued
+    PUSH_FULL = 1,    // OVERFLOW_BLOCK and no free slot: the item is left untouched
+    PUSH_DROPPED = 2, // OVERFLOW_DROP_NEWEST and no free slot: the item is discarded
+    PUSH_CLOSED = 3   // the ring has been closed
+}PushResult;
+
+// Outcome of a pop with a deadline
+typedef enum PopResult{
+    POP_OK = 0,
+    POP_TIMEOUT = 1, // nothing arrived before the deadline
+    POP_CLOSED = 2   // closed and drained
+}PopResult;
+
+// Bounded single-producer/single-consumer ring.
+// Push and pop are lock-free (sequence numbered cells); the mutex and the condition variable
+// are only touched when one side has to sleep because the ring is full or empty.
+template<typename T>
+class FrameRing{
+private:
+    struct Cell{
+        std::atomic<size_t> seq;
+        T data;
+    };
+    std::unique_ptr<Cell[]> cells;
+    size_t capacity;
+    OverflowPolicy policy;
+    alignas(64) std::atomic<size_t> enqueuePos;
+    alignas(64) std::atomic<size_t> dequeuePos;
+    alignas(64) std::atomic<int> waiters;
+    std::atomic<bool> closed;
+    std::atomic<unsigned long long> dropped;
+    std::mutex parkMx;
+    std::condition_variable parkCv;
+
+    bool canPush()const{
+        const size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        return cells[pos % capacity].seq.load(std::memory_order_acquire) == pos;
+    }
+
+    bool canPop()const{
+        const size_t pos = dequeuePos.load(std::memory_order_relaxed);
+        return cells[pos % capacity].seq.load(std::memory_order_acquire) == pos + 1;
+    }
+
+    bool tryEnqueue(T& item){
+        // Only the producer moves enqueuePos
+        const size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        Cell& cell = cells[pos % capacity];
+        if(cell.seq.load(std::memory_order_acquire) != pos) return false; // full, or the oldest cell is still being read
+        cell.data = std::move(item);
+        cell.seq.store(pos + 1, std::memory_order_release);
+        enqueuePos.store(pos + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool tryDequeue(T& out){
+        // The producer may also dequeue (OVERFLOW_DROP_OLDEST), so the position is claimed with a CAS
+        size_t pos = dequeuePos.load(std::memory_order_relaxed);
+        while(1){
+            Cell& cell = cells[pos % capacity];
+            const size_t seq = cell.seq.load(std::memory_order_acquire);
+            if(seq == pos + 1){
+                if(dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                    out = std::move(cell.data);
+                    cell.data = T(); // do not keep references to the frame inside the ring
+                    cell.seq.store(pos + capacity, std::memory_order_release);
+                    return true;
+                }
+            } else if(seq < pos + 1) return false; // empty
+            else pos = dequeuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    template<typename Pred>
+    void park(Pred ready){
+        waiters.fetch_add(1, std::memory_order_seq_cst);
+        std::unique_lock lk(parkMx);
+        parkCv.wait(lk, ready);
+        lk.unlock();
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // Same as park(), false if the deadline expired first
+    template<typename Pred, typename TimePoint>
+    bool parkUntil(Pred ready, const TimePoint& deadline){
+        waiters.fetch_add(1, std::memory_order_seq_cst);
+        std::unique_lock lk(parkMx);
+        bool ok = parkCv.wait_until(lk, deadline, ready);
+        lk.unlock();
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+        return ok;
+    }
+
+    void wakeWaiters(){
+        // Pairs with the fetch_add in park(): either the sleeper sees the new state or we see the sleeper
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(waiters.load(std::memory_order_relaxed) > 0){
+            { std::lock_guard lk(parkMx); }
+            parkCv.notify_all();
+        }
+    }
+
+public:
+    FrameRing(size_t _capacity = 1, OverflowPolicy _policy = OVERFLOW_BLOCK){
+        reset(_capacity, _policy);
+    }
+
+    // Resize the ring and change its policy. Not thread safe: call it before the threads start.
+    void reset(size_t _capacity, OverflowPolicy _policy){
+        capacity = _capacity > 0 ? _capacity : 1;
+        policy = _policy;
+        cells.reset(new Cell[capacity]);
+        for(size_t i = 0; i < capacity; i++) cells[i].seq.store(i, std::memory_order_relaxed);
+        enqueuePos.store(0, std::memory_order_relaxed);
+        dequeuePos.store(0, std::memory_order_relaxed);
+        waiters.store(0, std::memory_order_relaxed);
+        closed.store(false, std::memory_order_relaxed);
+        dropped.store(0, std::memory_order_relaxed);
+    }
+
+    // Producer side. With OVERFLOW_BLOCK it waits for a free slot, so only PUSH_OK, PUSH_DROPPED (OVERFLOW_DROP_NEWEST)
+    // and PUSH_CLOSED are returned; the item is lost unless it is PUSH_OK.
+    PushResult push(T item){
+        while(!closed.load(std::memory_order_acquire)){
+            if(tryEnqueue(item)){
+                wakeWaiters();
+                return PUSH_OK;
+            }
+            if(policy == OVERFLOW_DROP_NEWEST){
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return PUSH_DROPPED;
+            }
+            if(policy == OVERFLOW_DROP_OLDEST){
+                T oldest;
+                if(tryDequeue(oldest)) dropped.fetch_add(1, std::memory_order_relaxed);
+                else std::this_thread::yield(); // the consumer is still reading the oldest cell
+                continue;
+            }
+            park([this] {return canPush() || closed.load(std::memory_order_acquire);});
+        }
+        return PUSH_CLOSED;
+    }
+
+    // Producer side. Never waits: a full ring returns PUSH_FULL (OVERFLOW_BLOCK) or PUSH_DROPPED (OVERFLOW_DROP_NEWEST),
+    // with OVERFLOW_DROP_OLDEST the item is always enqueued.
+    PushResult tryPush(T& item){
+        while(!closed.load(std::memory_order_acquire)){
+            if(tryEnqueue(item)){
+                wakeWaiters();
+                return PUSH_OK;
+            }
+            if(policy == OVERFLOW_DROP_NEWEST){
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                item = T();
+                return PUSH_DROPPED;
+            }
+            if(policy == OVERFLOW_BLOCK) return PUSH_FULL;
+            T oldest;
+            if(tryDequeue(oldest)) dropped.fetch_add(1, std::memory_order_relaxed);
+            else std::this_thread::yield(); // the consumer is still reading the oldest cell
+        }
+        return PUSH_CLOSED;
+    }
+
+    // Consumer side. Waits for an item; returns false once the ring is closed and drained.
+    bool pop(T& out){
+        while(1){
+            if(tryDequeue(out)){
+                wakeWaiters();
+                return true;
+            }
+            if(closed.load(std::memory_order_acquire) && !canPop()) return false;
+            park([this] {return canPop() || closed.load(std::memory_order_acquire);});
+        }
+    }
+
+    // Consumer side. Waits for an item until the deadline.
+    template<typename TimePoint>
+    PopResult popUntil(T& out, const TimePoint& deadline){
+        while(1){
+            if(tryDequeue(out)){
+                wakeWaiters();
+                return POP_OK;
+            }
+            if(closed.load(std::memory_order_acquire) && !canPop()) return POP_CLOSED;
+            if(!parkUntil([this] {return canPop() || closed.load(std::memory_order_acquire);}, deadline)){
+                if(!tryDequeue(out)) return POP_TIMEOUT;
+                wakeWaiters();
+                return POP_OK;
+            }
+        }
+    }
+
+    // Consumer side. Never waits.
+    bool tryPop(T& out){
+        if(!tryDequeue(out)) return false;
+        wakeWaiters();
+        return true;
+    }
+
+    // No more pushes are accepted, a blocked producer or consumer is woken up
+    void close(){
+        closed.store(true, std::memory_order_release);
+        { std::lock_guard lk(parkMx); }
+        parkCv.notify_all();
+    }
+
+    bool isClosed()const{
+        return closed.load(std::memory_order_acquire);
+    }
+
+    // True when the ring is closed and nothing is left to pop
+    bool isDrained()const{
+        return isClosed() && !canPop();
+    }
+
+    size_t size()const{
+        const size_t in = enqueuePos.load(std::memory_order_relaxed);
+        const size_t out = dequeuePos.load(std::memory_order_relaxed);
+        return in > out ? in - out : 0;
+    }
+
+    size_t getCapacity()const{
+        return capacity;
+    }
+
+    unsigned long long droppedCount()const{
+        return dropped.load(std::memory_order_relaxed);
+    }
+};
+
+#endif
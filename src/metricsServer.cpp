@@ -0,0 +1,212 @@
+#include "metricsServer.h"
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET SocketFd;
+#define closeSocket closesocket
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+typedef int SocketFd;
+#define closeSocket close
+#endif
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // a scraper closing early must not kill the program with SIGPIPE
+#endif
+
+#define METRICS_POLL_MS 200 // how often the server checks stopping
+#define METRICS_RECV_TIMEOUT_MS 1000
+#define METRICS_MAX_REQUEST 4096
+
+MetricsServer::MetricsServer(){
+    stopping = false;
+    scrapes = 0;
+    listenFd = -1;
+}
+
+MetricsServer::~MetricsServer(){
+    stop();
+}
+
+void MetricsServer::start(const std::string& _address, std::function<void(std::ostream&)> _render){
+    if(worker.joinable()) return;
+    address = _address;
+    render = std::move(_render);
+#ifdef _WIN32
+    WSADATA wsa;
+    if(WSAStartup(MAKEWORD(2, 2), &wsa) != 0) throw std::runtime_error("Unable to initialize Winsock for the metrics server");
+#endif
+    SocketFd fd;
+    if(address.rfind("unix:", 0) == 0){
+#ifdef _WIN32
+        throw std::invalid_argument("Unix sockets are not supported on Windows, use host:port for the metrics address '" + address + "'");
+#else
+        std::string path = address.substr(5);
+        sockaddr_un addr{};
+        if(path.empty() || path.size() >= sizeof(addr.sun_path)) throw std::invalid_argument("Invalid unix socket path in the metrics address '" + address + "'");
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(fd < 0) throw std::runtime_error("Unable to create the metrics socket");
+        unlink(path.c_str()); // left behind by a previous run
+        if(bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 4) != 0){
+            closeSocket(fd);
+            throw std::runtime_error("Unable to listen on '" + path + "' for the metrics");
+        }
+        unixPath = path;
+#endif
+    } else {
+        size_t colon = address.rfind(':');
+        if(colon == std::string::npos) throw std::invalid_argument("The metrics address '" + address + "' must be host:port or unix:path");
+        std::string host = address.substr(0, colon);
+        if(host.empty() || host == "localhost") host = "127.0.0.1";
+        int port = std::stoi(address.substr(colon + 1));
+        if(port <= 0 || port > 65535) throw std::invalid_argument("Invalid port in the metrics address '" + address + "'");
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        if(inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) throw std::invalid_argument("Invalid IPv4 host in the metrics address '" + address + "'");
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+#ifdef _WIN32
+        if(fd == INVALID_SOCKET) throw std::runtime_error("Unable to create the metrics socket");
+#else
+        if(fd < 0) throw std::runtime_error("Unable to create the metrics socket");
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)); // restart right after a previous run
+#endif
+        if(bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 4) != 0){
+            closeSocket(fd);
+            throw std::runtime_error("Unable to listen on " + address + " for the metrics");
+        }
+    }
+    listenFd = (long long)fd;
+    stopping = false;
+    worker = std::thread(&MetricsServer::run, this);
+}
+
+void MetricsServer::stop(){
+    if(!worker.joinable()) return;
+    stopping = true;
+    worker.join();
+    closeSocket((SocketFd)listenFd);
+    listenFd = -1;
+#ifdef _WIN32
+    WSACleanup();
+#else
+    if(!unixPath.empty()) unlink(unixPath.c_str());
+#endif
+    unixPath.clear();
+}
+
+bool MetricsServer::isRunning()const{
+    return worker.joinable();
+}
+
+unsigned long long MetricsServer::scrapeCount()const{
+    return scrapes.load(std::memory_order_relaxed);
+}
+
+void MetricsServer::run(){
+    SocketFd fd = (SocketFd)listenFd;
+    while(!stopping){
+        // Wait for a connection, waking up periodically to check stopping
+        fd_set readSet;
+        FD_ZERO(&readSet);
+        FD_SET(fd, &readSet);
+        timeval timeout{0, METRICS_POLL_MS*1000};
+        if(select((int)fd + 1, &readSet, nullptr, nullptr, &timeout) <= 0) continue;
+        SocketFd client = accept(fd, nullptr, nullptr);
+#ifdef _WIN32
+        if(client == INVALID_SOCKET) continue;
+#else
+        if(client < 0) continue;
+#endif
+        serve((long long)client);
+        closeSocket(client);
+    }
+}
+
+void MetricsServer::serve(const long long clientFd){
+    SocketFd client = (SocketFd)clientFd;
+    // A client that never sends its request must not block the server
+#ifdef _WIN32
+    DWORD recvTimeout = METRICS_RECV_TIMEOUT_MS;
+#else
+    timeval recvTimeout{METRICS_RECV_TIMEOUT_MS/1000, (METRICS_RECV_TIMEOUT_MS%1000)*1000};
+#endif
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, (const char*)&recvTimeout, sizeof(recvTimeout));
+
+    // Read the request head, the body (if any) is ignored
+    std::string request;
+    char buf[512];
+    while(request.size() < METRICS_MAX_REQUEST && request.find("\r\n\r\n") == std::string::npos){
+        int n = recv(client, buf, sizeof(buf), 0);
+        if(n <= 0) break;
+        request.append(buf, n);
+    }
+    std::istringstream requestLine(request.substr(0, request.find("\r\n")));
+    std::string method, path;
+    requestLine >> method >> path;
+    path = path.substr(0, path.find('?'));
+
+    std::string status = "200 OK";
+    std::ostringstream body;
+    if(method != "GET" && method != "HEAD"){
+        status = "405 Method Not Allowed";
+        body << "Only GET is supported\n";
+    } else if(path != "/metrics" && path != "/"){
+        status = "404 Not Found";
+        body << "The metrics are served at /metrics\n";
+    } else {
+        render(body);
+        scrapes.fetch_add(1, std::memory_order_relaxed);
+    }
+    std::string content = body.str();
+    std::string response = "HTTP/1.0 " + status + "\r\n"
+                           "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                           "Content-Length: " + std::to_string(content.size()) + "\r\n"
+                           "Connection: close\r\n\r\n";
+    if(method != "HEAD") response += content;
+    size_t sent = 0;
+    while(sent < response.size()){
+        int n = send(client, response.data() + sent, (int)(response.size() - sent), MSG_NOSIGNAL);
+        if(n <= 0) break;
+        sent += n;
+    }
+}
+
+// ---- MetricsWriter ----
+
+void MetricsWriter::family(const std::string& name, const std::string& type, const std::string& help){
+    os << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n";
+}
+
+void MetricsWriter::sample(const std::string& name, const std::string& labels, const double value){
+    os << name;
+    if(!labels.empty()) os << "{" << labels << "}";
+    os << " " << std::setprecision(6) << value << "\n";
+}
+
+void MetricsWriter::sample(const std::string& name, const std::string& labels, const unsigned long long value){
+    os << name;
+    if(!labels.empty()) os << "{" << labels << "}";
+    os << " " << value << "\n";
+}
+
+std::string MetricsWriter::label(const std::string& key, const std::string& value){
+    std::string escaped;
+    for(char c : value){
+        if(c == '\\' || c == '"') escaped += '\\';
+        if(c == '\n') escaped += "\\n";
+        else escaped += c;
+    }
+    return key + "=\"" + escaped + "\"";
+}
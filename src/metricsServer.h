@@ -0,0 +1,49 @@
+#ifndef __METRICS_SERVER__
+#define __METRICS_SERVER__
+
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+
+// Minimal HTTP endpoint serving the metrics in the Prometheus text format (GET /metrics).
+// The address is "host:port" (TCP, e.g. 127.0.0.1:9100) or "unix:/path/to/socket" (not on Windows).
+// Requests are served one at a time on a thread of its own: the render callback must only read atomics,
+// so scraping never takes a lock the cameras or the scene wait on.
+class MetricsServer{
+private:
+    std::string address;
+    std::function<void(std::ostream&)> render;
+    std::thread worker;
+    std::atomic<bool> stopping;
+    std::atomic<unsigned long long> scrapes;
+    long long listenFd;
+    std::string unixPath; // removed by stop()
+    void run();
+    void serve(const long long fd);
+public:
+    MetricsServer();
+    ~MetricsServer();
+    // Binds the socket and starts serving. Throws std::runtime_error if the address cannot be bound
+    // and std::invalid_argument if it is malformed.
+    void start(const std::string& _address, std::function<void(std::ostream&)> _render);
+    void stop();
+    bool isRunning()const;
+    unsigned long long scrapeCount()const;
+};
+
+// Helpers to write the Prometheus exposition format
+class MetricsWriter{
+private:
+    std::ostream& os;
+public:
+    MetricsWriter(std::ostream& _os) : os(_os){}
+    // "# HELP" and "# TYPE" lines, once per metric name
+    void family(const std::string& name, const std::string& type, const std::string& help);
+    void sample(const std::string& name, const std::string& labels, const double value);
+    void sample(const std::string& name, const std::string& labels, const unsigned long long value);
+    static std::string label(const std::string& key, const std::string& value); // key="escaped value"
+};
+
+#endif
@@ -0,0 +1,183 @@
+#include "monitorCompositor.h"
+#include <iomanip>
+#include <cstdio>
+
+#define MONITOR_WINDOW "General Monitor"
+
+MonitorCompositor::MonitorCompositor(){
+    encoder = nullptr;
+    displayFps = 0;
+    running = false;
+    composed = 0;
+    tilesDrawn = 0;
+    displayed = 0;
+    encodeDropped = 0;
+    skipped = 0;
+}
+
+MonitorCompositor::~MonitorCompositor(){
+    release();
+}
+
+void MonitorCompositor::open(const int cameras, AsyncVideoWriter* _encoder, const int queueDepth, const double _displayFps){
+    encoder = _encoder;
+    displayFps = _displayFps;
+    // Skip the newest update when the compositor is behind: the scene never waits for the monitor and keeps the update
+    queue.reset(2, OVERFLOW_BLOCK);
+    spares.reset(4, OVERFLOW_DROP_NEWEST); // the queue, the one being composed and the one of the scene
+    canvas = cv::Mat::zeros(cv::Size(MONITOR_WIDTH, 224 + 112*((cameras - 1)/4)), CV_8UC3);
+    // One buffer per camera (copies of a cv::Mat would share the pixels), the thumbnails are resized into them
+    thumbnails.clear();
+    for(int i = 0; i < cameras; i++) thumbnails.push_back(cv::Mat(112, 199, CV_8UC3, cv::Scalar(33,33,33)));
+    statsText.assign(cameras, "");
+    statsRow.reserve(128);
+    tileState.assign(cameras, -1);
+    pool.preallocate(queueDepth + 1, canvas.size(), CV_8UC3);
+    clear();
+}
+
+void MonitorCompositor::start(){
+    if(worker.joinable()) return;
+    running = true;
+    worker = std::thread(&MonitorCompositor::run, this);
+}
+
+bool MonitorCompositor::submit(MonitorUpdate& update){
+    if(!running.load(std::memory_order_relaxed)) return false;
+    const PushResult pushed = queue.tryPush(update);
+    if(pushed == PUSH_CLOSED) return false;
+    if(pushed == PUSH_FULL){
+        skipped++; // the scene reuses the update for the next tick
+        return true;
+    }
+    spares.tryPop(update); // empty until the first updates come back
+    return true;
+}
+
+void MonitorCompositor::release(){
+    if(!worker.joinable()) return;
+    queue.close();
+    worker.join();
+}
+
+bool MonitorCompositor::isRunning()const{
+    return running.load(std::memory_order_relaxed);
+}
+
+int MonitorCompositor::height()const{
+    return canvas.rows;
+}
+
+void MonitorCompositor::run(){
+    TRACE_THREAD_NAME("MONITOR");
+    // HighGUI windows belong to the thread that creates them
+    if(displayFps > 0){
+        cv::namedWindow(MONITOR_WINDOW, cv::WINDOW_NORMAL);
+        cv::resizeWindow(MONITOR_WINDOW, canvas.cols, canvas.rows);
+    }
+    MonitorUpdate update;
+    while(queue.pop(update)){
+        compose(update);
+        // Give the frames back to the capture pools, the tiles go back to the scene
+        for(auto& tile : update.tiles) tile.frame.release();
+        update.live.release();
+        const int fps = update.fps;
+        spares.tryPush(update);
+        show(fps);
+        if(!running) break;
+    }
+    running = false;
+    while(queue.tryPop(update)); // drop the references left in the queue
+    if(displayFps > 0) cv::destroyWindow(MONITOR_WINDOW);
+}
+
+void MonitorCompositor::compose(const MonitorUpdate& update){
+    TRACE_SCOPE(&trace, "compose");
+    for(int i = 0; i < update.tiles.size() && i < thumbnails.size(); i++){
+        const MonitorTile& tile = update.tiles[i];
+        const bool isLive = i == update.liveIndex;
+        // Only the cameras with a new frame, or going on or off air, are redrawn
+        bool dirty = tileState[i] != (int)isLive;
+        if(!tile.frame.empty()){
+            scalePlans.get(tile.frame.size(), thumbnails[i].size()).apply(tile.frame, thumbnails[i]);
+            dirty = true;
+        }
+        if(dirty) drawTile(i, tile, isLive);
+        if(tile.analysis && !(update.frameNum % MONITOR_STATS_INTERVAL)) drawStats(i, tile);
+    }
+    if(!update.live.empty()){ // show the top left output
+        cv::Mat previewArea = canvas.rowRange(0, 224).colRange(0, 398);
+        scalePlans.get(update.live.size(), previewArea.size()).apply(update.live, previewArea);
+    }
+    if(encoder != nullptr && encoder->isOpened()){
+        // The canvas keeps changing, the encoder gets a copy
+        cv::Mat monitorFrame = pool.acquire();
+        canvas.copyTo(monitorFrame);
+        pool.traffic.countCopy(monitorFrame);
+        if(encoder->write(monitorFrame) == PUSH_DROPPED) encodeDropped++; // the encoder is behind (OVERFLOW_DROP_NEWEST)
+    }
+    composed++;
+}
+
+void MonitorCompositor::drawTile(const int i, const MonitorTile& tile, const bool isLive){
+    int xOffset = i < 4 ? 398 + 199*(i%2) : 199*(i%4);
+    int yOffset = i < 4 ? 112*(i/2) : 224 + 112*((i-4)/4);
+    cv::Mat area = canvas.rowRange(yOffset, yOffset + 112).colRange(xOffset, xOffset + thumbnails[i].cols);
+    thumbnails[i].copyTo(area);
+    if(isLive) cv::rectangle(area, cv::Rect(0,0, area.cols, area.rows), cv::Scalar(0,255,0), 4,8);
+    cv::putText(area, std::to_string(i+1), cv::Point(6,20), cv::FONT_HERSHEY_PLAIN, 1.3, CV_RGB(230, 230, 230), 1, cv::LINE_AA);
+    tileState[i] = isLive;
+    tilesDrawn++;
+}
+
+void MonitorCompositor::drawStats(const int i, const MonitorTile& tile){
+    // Short fixed size fields: no stream, and the strings handed to putText fit in their small buffer
+    char stats[6][16];
+    std::snprintf(stats[0], sizeof(stats[0]), "%d", i + 1);
+    std::snprintf(stats[1], sizeof(stats[1]), "%d", tile.area_n);
+    std::snprintf(stats[2], sizeof(stats[2]), "%.1f", tile.area);
+    std::snprintf(stats[3], sizeof(stats[3]), "%.2f", tile.vel);
+    std::snprintf(stats[4], sizeof(stats[4]), "%d", tile.weight);
+    std::snprintf(stats[5], sizeof(stats[5]), "%.1f", tile.score);
+
+    // The row is rewritten only when its text changes
+    statsRow.clear();
+    for(const auto& s : stats){
+        statsRow += s;
+        statsRow += '|';
+    }
+    if(statsRow == statsText[i]) return;
+    statsText[i] = statsRow;
+    canvas(cv::Rect(805, 42 + i*30, canvas.cols - 805, 26)) = cv::Scalar(33,33,33);
+    for(int j = 0; j < 6; j++){
+        cv::putText(canvas, stats[j], cv::Point(810 + 90*j, 60 + i*30), cv::FONT_HERSHEY_PLAIN, 1.3, CV_RGB(230, 230, 230), 1, cv::LINE_AA);
+    }
+}
+
+void MonitorCompositor::clear(){
+    canvas = cv::Scalar(33,33,33);
+    cv::putText(canvas, "CAM     N       A       V       W       S", cv::Point(810, 30), cv::FONT_HERSHEY_PLAIN, 1.3, CV_RGB(230, 230, 230), 1, cv::LINE_AA);
+    cv::putText(canvas, "N = number of areas, A = area, V = avg speed", cv::Point(810, canvas.rows - 24), cv::FONT_HERSHEY_PLAIN, 1, CV_RGB(230, 230, 230), 1, cv::LINE_AA);
+    cv::putText(canvas, "W = frame weight, S = final score", cv::Point(810, canvas.rows - 10), cv::FONT_HERSHEY_PLAIN, 1, CV_RGB(230, 230, 230), 1, cv::LINE_AA);
+}
+
+void MonitorCompositor::show(const int fps){
+    if(displayFps <= 0) return;
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if(displayed > 0 && now - lastDisplay < std::chrono::duration<double>(1/displayFps)) return;
+    TRACE_SCOPE(&trace, "display");
+    lastDisplay = now;
+    canvas(cv::Rect(805, canvas.rows - 60, canvas.cols - 805, 20)) = cv::Scalar(33,33,33);
+    cv::putText(canvas, "FPS: " + std::to_string(fps), cv::Point(810, canvas.rows - 45), cv::FONT_HERSHEY_PLAIN, 1.2, CV_RGB(230, 230, 230), 1, cv::LINE_AA);
+    cv::imshow(MONITOR_WINDOW, canvas);
+    cv::waitKey(1);
+    displayed++;
+    if(!cv::getWindowProperty(MONITOR_WINDOW, cv::WND_PROP_VISIBLE)) running = false; // window closed: stop the monitor
+}
+
+std::ostream& operator <<(std::ostream& os, const MonitorCompositor& m){
+    os << "MONITOR COMPOSITOR: " << m.composed << " updates composed, " << m.skipped << " skipped, "
+       << std::fixed << std::setprecision(2) << (m.composed ? m.tilesDrawn/(double)m.composed : 0) << " tiles redrawn per update, "
+       << m.displayed << " frames displayed, " << m.encodeDropped << " dropped by the encoder";
+    return os;
+}
@@ -0,0 +1,82 @@
+#ifndef __MONITOR_COMPOSITOR__
+#define __MONITOR_COMPOSITOR__
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "asyncVideoWriter.h"
+#include "frameRing.h"
+#include "framePool.h"
+#include "scalePlan.h"
+#include "trace.h"
+
+#define MONITOR_WIDTH 1350
+#define MONITOR_STATS_INTERVAL 15 // frames between two updates of the stats text
+
+// What the scene knows about a camera at the end of a tick
+struct MonitorTile{
+    cv::Mat frame; // shares the pooled buffer of the capture, empty if the frame was not decoded
+    bool analysis = false;
+    int weight = 0;
+    double score = 0;
+    double area = 0;
+    double vel = 0;
+    int area_n = 0;
+};
+
+struct MonitorUpdate{
+    std::vector<MonitorTile> tiles; // one per capture
+    cv::Mat live; // frame on air, drawn in the preview
+    int liveIndex = -1;
+    unsigned int frameNum = 0;
+    int fps = 0;
+};
+
+// General monitor, composed on a thread of its own.
+// The scene only queues references to the frames of the tick (never waits, a busy compositor skips updates);
+// the compositor redraws the tile of a camera only when it brought a new frame or went on or off air,
+// rewrites the stats text every MONITOR_STATS_INTERVAL frames and refreshes its window at displayFps.
+// The composed updates go back to the scene through the spares ring, so the tiles are not reallocated every tick.
+class MonitorCompositor{
+    friend class KernelBench; // bench/kernelBench.cpp measures compose()
+private:
+    FrameRing<MonitorUpdate> queue;
+    FrameRing<MonitorUpdate> spares; // composed updates, without their frames, refilled by the scene
+    std::thread worker;
+    cv::Mat canvas;
+    std::vector<cv::Mat> thumbnails; // last thumbnail of each camera, kept for the cameras that skip decoding
+    std::vector<std::string> statsText; // cached stats row of each camera
+    std::string statsRow; // scratch for the row being formatted
+    std::vector<int> tileState; // -1 = never drawn, 0 = drawn off air, 1 = drawn on air
+    ScalePlanCache scalePlans;
+    FramePool pool; // buffers handed to the encoder, owned by the compositor thread
+    AsyncVideoWriter* encoder;
+    double displayFps; // 0 = no window
+    std::chrono::steady_clock::time_point lastDisplay;
+    std::atomic<bool> running;
+    unsigned long long composed, tilesDrawn, displayed, encodeDropped; // read once the thread is joined
+    unsigned long long skipped; // written by the scene
+    void run();
+    void drawTile(const int i, const MonitorTile& tile, const bool isLive);
+    void drawStats(const int i, const MonitorTile& tile);
+    void clear();
+    void show(const int fps);
+public:
+    TraceTrack trace{"MONITOR"};
+    MonitorCompositor();
+    ~MonitorCompositor();
+    // Allocate the canvas for the cameras. encoder may be nullptr; displayFps 0 keeps the window closed.
+    void open(const int cameras, AsyncVideoWriter* _encoder, const int queueDepth, const double _displayFps);
+    void start();
+    bool submit(MonitorUpdate& update); // scene side, never waits; update gets the tiles of a composed one
+    void compose(const MonitorUpdate& update); // one update on the calling thread
+    void release(); // compose the queued updates and join the thread
+    bool isRunning()const; // false once the window has been closed
+    int height()const;
+    friend std::ostream& operator <<(std::ostream& os, const MonitorCompositor& m);
+};
+
+#endif
@@ -0,0 +1,89 @@
+#include "motionGate.h"
+#include "simdDispatch.h"
+#include <cstdlib>
+#include <algorithm>
+
+static_assert(GATE_TILE % 16 == 0, "a row of a tile must be made of whole 16 byte registers");
+
+MotionGate::MotionGate(){
+    tilesX = 0;
+    tilesY = 0;
+    changedCount = 0;
+}
+
+// ---- Sum of absolute differences of a row, added to the tiles it crosses ----
+
+static void rowSadScalar(const uchar* a, const uchar* b, uint32_t* tileSad, const int from, const int cols){
+    for(int x = from; x < cols; x++) tileSad[x/GATE_TILE] += std::abs(a[x] - b[x]);
+}
+
+#ifdef SIMD_X86
+SIMD_TARGET_AVX2 static int rowSadAVX2(const uchar* a, const uchar* b, uint32_t* tileSad, const int cols){
+    int x = 0;
+    for(; x <= cols - 32; x += 32){
+        // Four partial sums of 8 pixels: the low 128 bits belong to the tile of x, the high ones to the tile of x + 16
+        __m256i s = _mm256_sad_epu8(_mm256_loadu_si256((const __m256i*)(a + x)), _mm256_loadu_si256((const __m256i*)(b + x)));
+        tileSad[x/GATE_TILE] += _mm256_extract_epi16(s, 0) + _mm256_extract_epi16(s, 4);
+        tileSad[(x + 16)/GATE_TILE] += _mm256_extract_epi16(s, 8) + _mm256_extract_epi16(s, 12);
+    }
+    return x;
+}
+
+SIMD_TARGET_SSE41 static int rowSadSSE41(const uchar* a, const uchar* b, uint32_t* tileSad, const int cols){
+    int x = 0;
+    for(; x <= cols - 16; x += 16){
+        __m128i s = _mm_sad_epu8(_mm_loadu_si128((const __m128i*)(a + x)), _mm_loadu_si128((const __m128i*)(b + x)));
+        tileSad[x/GATE_TILE] += _mm_extract_epi16(s, 0) + _mm_extract_epi16(s, 4);
+    }
+    return x;
+}
+#endif
+
+static void rowSad(const uchar* a, const uchar* b, uint32_t* tileSad, const int cols){
+    int x = 0;
+#ifdef SIMD_X86
+    switch(simdLevel()){
+        case SIMD_AVX2: x = rowSadAVX2(a, b, tileSad, cols); break;
+        case SIMD_SSE41: x = rowSadSSE41(a, b, tileSad, cols); break;
+        default: break;
+    }
+#endif
+    rowSadScalar(a, b, tileSad, x, cols);
+}
+
+int MotionGate::run(const cv::Mat& prev, const cv::Mat& curr, const double meanThreshold){
+    const int rows = curr.rows, cols = curr.cols;
+    tilesX = (cols + GATE_TILE - 1)/GATE_TILE;
+    tilesY = (rows + GATE_TILE - 1)/GATE_TILE;
+    sad.assign(tilesX*tilesY, 0); // keeps the capacity: no allocation once warmed up
+    for(int y = 0; y < rows; y++) rowSad(prev.ptr<uchar>(y), curr.ptr<uchar>(y), sad.data() + (y/GATE_TILE)*tilesX, cols);
+
+    // The tiles on the right and bottom edges may be smaller
+    if(spans.size() < tilesY) spans.resize(tilesY);
+    changedCount = 0;
+    for(int ty = 0; ty < tilesY; ty++){
+        spans[ty].clear();
+        spans[ty].reserve((tilesX + 1)/2); // adjacent tiles merge: the most spans a row can have
+        const int height = std::min(GATE_TILE, rows - ty*GATE_TILE);
+        for(int tx = 0; tx < tilesX; tx++){
+            const int x0 = tx*GATE_TILE, x1 = std::min(cols, x0 + GATE_TILE);
+            if(sad[ty*tilesX + tx] <= meanThreshold*height*(x1 - x0)) continue;
+            changedCount++;
+            if(!spans[ty].empty() && spans[ty].back().end == x0) spans[ty].back().end = x1;
+            else spans[ty].push_back(cv::Range(x0, x1));
+        }
+    }
+    return changedCount;
+}
+
+int MotionGate::tileCount()const{
+    return tilesX*tilesY;
+}
+
+int MotionGate::changedTiles()const{
+    return changedCount;
+}
+
+const std::vector<cv::Range>& MotionGate::rowSpans(const int y)const{
+    return spans[y/GATE_TILE];
+}
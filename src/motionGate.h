@@ -0,0 +1,29 @@
+#ifndef __MOTION_GATE__
+#define __MOTION_GATE__
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include <cstdint>
+
+#define GATE_TILE 16 // side of the tiles in pixels of the analyzed frame, a multiple of 16 (one SSE register per tile row)
+
+// Tile level change detector, run before the frame differencing: sum of absolute differences of every
+// GATE_TILE x GATE_TILE tile of two preprocessed frames. A tile changed if its mean absolute difference is above
+// the threshold. A frame without changed tiles needs no motion mask; otherwise the mask is only computed on the
+// changed tiles (the others are left empty).
+class MotionGate{
+private:
+    int tilesX;
+    int tilesY;
+    int changedCount;
+    std::vector<uint32_t> sad; // per tile, row major
+    std::vector<std::vector<cv::Range>> spans; // per row of tiles: column ranges of consecutive changed tiles
+public:
+    MotionGate();
+    int run(const cv::Mat& prev, const cv::Mat& curr, const double meanThreshold); // number of changed tiles
+    int tileCount()const;
+    int changedTiles()const;
+    const std::vector<cv::Range>& rowSpans(const int y)const; // changed columns of pixel row y, empty if none
+};
+
+#endif
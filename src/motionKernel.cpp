@@ -0,0 +1,201 @@
+#include "motionKernel.h"
+#include "simdDispatch.h"
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+// Half width of each row of the elliptic structuring element, like cv::getStructuringElement(MORPH_ELLIPSE):
+// round(sqrt(R^2 - dy^2)) computed at compile time
+static constexpr int roundSqrt(const int v){
+    int d = 0;
+    while((2*d + 1)*(2*d + 1) <= 4*v) d++;
+    return d;
+}
+
+struct EllipseRows{
+    int halfWidth[2*DILATE_SIZE + 1];
+    bool used[DILATE_SIZE + 1]; // which horizontal dilations are needed
+    constexpr EllipseRows() : halfWidth(), used(){
+        for(int dy = -DILATE_SIZE; dy <= DILATE_SIZE; dy++){
+            halfWidth[dy + DILATE_SIZE] = roundSqrt(DILATE_SIZE*DILATE_SIZE - dy*dy);
+            used[halfWidth[dy + DILATE_SIZE]] = true;
+        }
+    }
+};
+static constexpr EllipseRows ellipse;
+
+BinaryMask::BinaryMask(){
+    rows = 0;
+    cols = 0;
+    wordsPerRow = 0;
+}
+
+void BinaryMask::create(const int _rows, const int _cols){
+    rows = _rows;
+    cols = _cols;
+    wordsPerRow = (cols + 63)/64;
+    bits.resize(rows*wordsPerRow); // keeps the capacity: no allocation once warmed up
+}
+
+uint64_t* BinaryMask::row(const int y){
+    return bits.data() + y*wordsPerRow;
+}
+
+const uint64_t* BinaryMask::row(const int y)const{
+    return bits.data() + y*wordsPerRow;
+}
+
+uint64_t BinaryMask::lastWordMask()const{
+    return cols%64 ? (((uint64_t)1 << (cols%64)) - 1) : ~(uint64_t)0;
+}
+
+void BinaryMask::toMat(cv::Mat& dst)const{
+    dst.create(rows, cols, CV_8UC1);
+    for(int y = 0; y < rows; y++){
+        const uint64_t* r = row(y);
+        uchar* d = dst.ptr<uchar>(y);
+        for(int x = 0; x < cols; x++) d[x] = (r[x >> 6] >> (x & 63)) & 1 ? 255 : 0;
+    }
+}
+
+// ---- |a - b| > threshold packed in bits ----
+
+static void thresholdDiffScalar(const uchar* a, const uchar* b, const int threshold, uint64_t* out, const int from, const int to){
+    for(int x = from; x < to; x++){
+        if(std::abs(a[x] - b[x]) > threshold) out[x >> 6] |= (uint64_t)1 << (x & 63);
+    }
+}
+
+#ifdef SIMD_X86
+// from is a multiple of 16: the 32 bits of a step may cross a word boundary
+SIMD_TARGET_AVX2 static int thresholdDiffAVX2(const uchar* a, const uchar* b, const int threshold, uint64_t* out, const int from, const int to){
+    const __m256i t = _mm256_set1_epi8((char)threshold);
+    const __m256i zero = _mm256_setzero_si256();
+    int x = from;
+    for(; x <= to - 32; x += 32){
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a + x));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + x));
+        __m256i d = _mm256_or_si256(_mm256_subs_epu8(va, vb), _mm256_subs_epu8(vb, va)); // absdiff
+        uint32_t le = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_subs_epu8(d, t), zero)); // d <= threshold
+        const uint64_t set = (uint32_t)~le;
+        out[x >> 6] |= set << (x & 63);
+        if((x & 63) > 32) out[(x >> 6) + 1] |= set >> (64 - (x & 63));
+    }
+    return x;
+}
+
+SIMD_TARGET_SSE41 static int thresholdDiffSSE41(const uchar* a, const uchar* b, const int threshold, uint64_t* out, const int from, const int to){
+    const __m128i t = _mm_set1_epi8((char)threshold);
+    const __m128i zero = _mm_setzero_si128();
+    int x = from;
+    for(; x <= to - 16; x += 16){
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + x));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + x));
+        __m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+        uint32_t le = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(d, t), zero)) & 0xFFFF;
+        out[x >> 6] |= (uint64_t)(~le & 0xFFFF) << (x & 63);
+    }
+    return x;
+}
+#endif
+
+// Pixels [from, to) of a cleared row, from is a multiple of 16
+static void thresholdDiffSpan(const uchar* a, const uchar* b, const int threshold, uint64_t* out, const int from, const int to){
+    int x = from;
+#ifdef SIMD_X86
+    switch(simdLevel()){
+        case SIMD_AVX2: x = thresholdDiffAVX2(a, b, threshold, out, from, to); break;
+        case SIMD_SSE41: x = thresholdDiffSSE41(a, b, threshold, out, from, to); break;
+        default: break;
+    }
+#endif
+    thresholdDiffScalar(a, b, threshold, out, x, to);
+}
+
+static void thresholdDiff(const uchar* a, const uchar* b, const int threshold, uint64_t* out, const int words, const int cols){
+    std::memset(out, 0, words*sizeof(uint64_t));
+    thresholdDiffSpan(a, b, threshold, out, 0, cols);
+}
+
+// ---- Binary dilation ----
+
+// out pixel x is set if any input pixel in [x - radius, x + radius] is set
+static void dilateRow(const uint64_t* in, uint64_t* out, const int words, const int radius, const uint64_t lastMask){
+    for(int i = 0; i < words; i++){
+        const uint64_t prev = i > 0 ? in[i - 1] : 0;
+        const uint64_t next = i < words - 1 ? in[i + 1] : 0;
+        uint64_t acc = in[i];
+        for(int s = 1; s <= radius; s++){
+            acc |= (in[i] << s) | (prev >> (64 - s)); // from the pixels on the left
+            acc |= (in[i] >> s) | (next << (64 - s)); // from the pixels on the right
+        }
+        out[i] = acc;
+    }
+    out[words - 1] &= lastMask;
+}
+
+void MotionKernel::run(const cv::Mat& prev, const cv::Mat& curr, const int threshold, BinaryMask& out, const int stripes, const ParallelFor& parallelFor,
+                       const MotionGate* gate){
+    const int rows = curr.rows, cols = curr.cols;
+    diffBits.create(rows, cols);
+    wideBits.create(rows*(DILATE_SIZE + 1), cols); // one plane per horizontal radius
+    rowActive.assign(rows, 1);
+    const int words = diffBits.wordsPerRow;
+    const int n = std::max(1, stripes);
+
+    parallelFor(n, [&](const int i){
+        int y0, y1;
+        stripeRows(i, n, rows, y0, y1);
+        for(int y = y0; y < y1; y++){
+            if(gate != nullptr){
+                // Only the changed tiles, the rows of a band without any are never read again
+                const std::vector<cv::Range>& spans = gate->rowSpans(y);
+                rowActive[y] = !spans.empty();
+                if(!rowActive[y]) continue;
+                std::memset(diffBits.row(y), 0, words*sizeof(uint64_t));
+                for(const cv::Range& span : spans) thresholdDiffSpan(prev.ptr<uchar>(y), curr.ptr<uchar>(y), threshold, diffBits.row(y), span.start, span.end);
+            }
+            else thresholdDiff(prev.ptr<uchar>(y), curr.ptr<uchar>(y), threshold, diffBits.row(y), words, cols);
+            dilateHorizontal(diffBits, y);
+        }
+    });
+    dilateVertical(out, n, parallelFor);
+}
+
+void MotionKernel::dilate(const BinaryMask& in, BinaryMask& out, const int stripes, const ParallelFor& parallelFor){
+    wideBits.create(in.rows*(DILATE_SIZE + 1), in.cols);
+    rowActive.assign(in.rows, 1);
+    const int n = std::max(1, stripes);
+    parallelFor(n, [&](const int i){
+        int y0, y1;
+        stripeRows(i, n, in.rows, y0, y1);
+        for(int y = y0; y < y1; y++) dilateHorizontal(in, y);
+    });
+    dilateVertical(out, n, parallelFor);
+}
+
+void MotionKernel::dilateHorizontal(const BinaryMask& in, const int y){
+    for(int r = 0; r <= DILATE_SIZE; r++){
+        if(ellipse.used[r]) dilateRow(in.row(y), wideBits.row(r*in.rows + y), in.wordsPerRow, r, in.lastWordMask());
+    }
+}
+
+void MotionKernel::dilateVertical(BinaryMask& out, const int stripes, const ParallelFor& parallelFor){
+    // OR the rows of the ellipse, the pixels outside the frame do not count
+    const int rows = rowActive.size(), cols = wideBits.cols;
+    out.create(rows, cols);
+    const int words = out.wordsPerRow;
+    parallelFor(stripes, [&](const int i){
+        int y0, y1;
+        stripeRows(i, stripes, rows, y0, y1);
+        for(int y = y0; y < y1; y++){
+            uint64_t* o = out.row(y);
+            std::memset(o, 0, words*sizeof(uint64_t));
+            for(int dy = -DILATE_SIZE; dy <= DILATE_SIZE; dy++){
+                if(y + dy < 0 || y + dy >= rows || !rowActive[y + dy]) continue;
+                const uint64_t* w = wideBits.row(ellipse.halfWidth[dy + DILATE_SIZE]*rows + y + dy);
+                for(int k = 0; k < words; k++) o[k] |= w[k];
+            }
+        }
+    });
+}
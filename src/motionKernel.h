@@ -0,0 +1,46 @@
+#ifndef __MOTION_KERNEL__
+#define __MOTION_KERNEL__
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include <cstdint>
+#include "stripes.h"
+#include "motionGate.h"
+
+#define DILATE_SIZE 2 // radius of the elliptic structuring element, depends on the resolution of the analyzed frame
+
+// Binary image packed 64 pixels per word: bit x%64 of word x/64 is pixel x of the row
+class BinaryMask{
+public:
+    int rows;
+    int cols;
+    int wordsPerRow;
+    std::vector<uint64_t> bits;
+    BinaryMask();
+    void create(const int _rows, const int _cols);
+    uint64_t* row(const int y);
+    const uint64_t* row(const int y)const;
+    uint64_t lastWordMask()const; // valid bits of the last word of a row
+    void toMat(cv::Mat& dst)const; // 0/255 image
+};
+
+// absdiff + threshold + dilation with the DILATE_SIZE ellipse, producing the binary motion mask.
+// Thresholding before dilating gives the same mask (both are monotone), and the dilation of a
+// packed binary image is a handful of shifts and ORs per 64 pixels.
+// Both passes can run in horizontal stripes, the vertical one starts once all the rows of the first are done.
+// With a gate only the changed tiles are differenced, and the rows without any are skipped by both passes.
+class MotionKernel{
+private:
+    BinaryMask diffBits; // |prev - curr| > threshold
+    BinaryMask wideBits; // diffBits dilated horizontally by the half width of the ellipse
+    std::vector<uint8_t> rowActive; // with a gate, rows of diffBits crossing a changed tile
+    void dilateHorizontal(const BinaryMask& in, const int y); // row y of in into the planes of wideBits
+    void dilateVertical(BinaryMask& out, const int stripes, const ParallelFor& parallelFor);
+public:
+    void run(const cv::Mat& prev, const cv::Mat& curr, const int threshold, BinaryMask& out, const int stripes = 1, const ParallelFor& parallelFor = serialFor,
+             const MotionGate* gate = nullptr);
+    // The same dilation on a mask computed elsewhere (e.g. the foreground of the background model)
+    void dilate(const BinaryMask& in, BinaryMask& out, const int stripes = 1, const ParallelFor& parallelFor = serialFor);
+};
+
+#endif
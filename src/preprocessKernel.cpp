@@ -0,0 +1,270 @@
+#include "preprocessKernel.h"
+#include "simdDispatch.h"
+#include <cmath>
+#include <cstring>
+
+static inline int reflect101(const int i, const int n){
+    if(i < 0) return -i;
+    if(i >= n) return 2*n - 2 - i;
+    return i;
+}
+
+// ---- Scalar kernels (reference and fallback) ----
+
+static void lerpRowsScalar(const float* a, const float* b, const float alpha, float* out, const int w){
+    for(int x = 0; x < w; x++) out[x] = a[x] + alpha*(b[x] - a[x]);
+}
+
+static void blurRowScalar(const float* in, float* out, const int w, const float* g, const int from, const int to){
+    for(int x = from; x < to; x++){
+        out[x] = g[0]*in[x] + g[1]*(in[reflect101(x - 1, w)] + in[reflect101(x + 1, w)])
+                            + g[2]*(in[reflect101(x - 2, w)] + in[reflect101(x + 2, w)]);
+    }
+}
+
+static void blurColumnsScalar(const float* const* r, uchar* dst, const int w, const float* g, const int from){
+    for(int x = from; x < w; x++){
+        dst[x] = cv::saturate_cast<uchar>(g[0]*r[2][x] + g[1]*(r[1][x] + r[3][x]) + g[2]*(r[0][x] + r[4][x]));
+    }
+}
+
+// ---- AVX2 kernels ----
+#ifdef SIMD_X86
+SIMD_TARGET_AVX2 static void lerpRowsAVX2(const float* a, const float* b, const float alpha, float* out, const int w){
+    const __m256 va = _mm256_set1_ps(alpha);
+    int x = 0;
+    for(; x <= w - 8; x += 8){
+        __m256 pa = _mm256_loadu_ps(a + x);
+        __m256 pb = _mm256_loadu_ps(b + x);
+        _mm256_storeu_ps(out + x, _mm256_add_ps(pa, _mm256_mul_ps(va, _mm256_sub_ps(pb, pa))));
+    }
+    lerpRowsScalar(a + x, b + x, alpha, out + x, w - x);
+}
+
+SIMD_TARGET_AVX2 static void blurRowAVX2(const float* in, float* out, const int w, const float* g){
+    const __m256 g0 = _mm256_set1_ps(g[0]), g1 = _mm256_set1_ps(g[1]), g2 = _mm256_set1_ps(g[2]);
+    blurRowScalar(in, out, w, g, 0, 2);
+    int x = 2;
+    for(; x <= w - 2 - 8; x += 8){
+        __m256 c = _mm256_loadu_ps(in + x);
+        __m256 n1 = _mm256_add_ps(_mm256_loadu_ps(in + x - 1), _mm256_loadu_ps(in + x + 1));
+        __m256 n2 = _mm256_add_ps(_mm256_loadu_ps(in + x - 2), _mm256_loadu_ps(in + x + 2));
+        _mm256_storeu_ps(out + x, _mm256_add_ps(_mm256_mul_ps(g0, c), _mm256_add_ps(_mm256_mul_ps(g1, n1), _mm256_mul_ps(g2, n2))));
+    }
+    blurRowScalar(in, out, w, g, x, w);
+}
+
+SIMD_TARGET_AVX2 static void blurColumnsAVX2(const float* const* r, uchar* dst, const int w, const float* g){
+    const __m256 g0 = _mm256_set1_ps(g[0]), g1 = _mm256_set1_ps(g[1]), g2 = _mm256_set1_ps(g[2]);
+    int x = 0;
+    for(; x <= w - 8; x += 8){
+        __m256 c = _mm256_loadu_ps(r[2] + x);
+        __m256 n1 = _mm256_add_ps(_mm256_loadu_ps(r[1] + x), _mm256_loadu_ps(r[3] + x));
+        __m256 n2 = _mm256_add_ps(_mm256_loadu_ps(r[0] + x), _mm256_loadu_ps(r[4] + x));
+        __m256 v = _mm256_add_ps(_mm256_mul_ps(g0, c), _mm256_add_ps(_mm256_mul_ps(g1, n1), _mm256_mul_ps(g2, n2)));
+        __m256i i32 = _mm256_cvtps_epi32(v); // round to nearest like cvRound
+        __m128i u16 = _mm_packus_epi32(_mm256_castsi256_si128(i32), _mm256_extracti128_si256(i32, 1));
+        _mm_storel_epi64((__m128i*)(dst + x), _mm_packus_epi16(u16, u16));
+    }
+    blurColumnsScalar(r, dst, w, g, x);
+}
+
+// ---- SSE4.1 kernels ----
+SIMD_TARGET_SSE41 static void lerpRowsSSE41(const float* a, const float* b, const float alpha, float* out, const int w){
+    const __m128 va = _mm_set1_ps(alpha);
+    int x = 0;
+    for(; x <= w - 4; x += 4){
+        __m128 pa = _mm_loadu_ps(a + x);
+        __m128 pb = _mm_loadu_ps(b + x);
+        _mm_storeu_ps(out + x, _mm_add_ps(pa, _mm_mul_ps(va, _mm_sub_ps(pb, pa))));
+    }
+    lerpRowsScalar(a + x, b + x, alpha, out + x, w - x);
+}
+
+SIMD_TARGET_SSE41 static void blurRowSSE41(const float* in, float* out, const int w, const float* g){
+    const __m128 g0 = _mm_set1_ps(g[0]), g1 = _mm_set1_ps(g[1]), g2 = _mm_set1_ps(g[2]);
+    blurRowScalar(in, out, w, g, 0, 2);
+    int x = 2;
+    for(; x <= w - 2 - 4; x += 4){
+        __m128 c = _mm_loadu_ps(in + x);
+        __m128 n1 = _mm_add_ps(_mm_loadu_ps(in + x - 1), _mm_loadu_ps(in + x + 1));
+        __m128 n2 = _mm_add_ps(_mm_loadu_ps(in + x - 2), _mm_loadu_ps(in + x + 2));
+        _mm_storeu_ps(out + x, _mm_add_ps(_mm_mul_ps(g0, c), _mm_add_ps(_mm_mul_ps(g1, n1), _mm_mul_ps(g2, n2))));
+    }
+    blurRowScalar(in, out, w, g, x, w);
+}
+
+SIMD_TARGET_SSE41 static void blurColumnsSSE41(const float* const* r, uchar* dst, const int w, const float* g){
+    const __m128 g0 = _mm_set1_ps(g[0]), g1 = _mm_set1_ps(g[1]), g2 = _mm_set1_ps(g[2]);
+    int x = 0;
+    for(; x <= w - 4; x += 4){
+        __m128 c = _mm_loadu_ps(r[2] + x);
+        __m128 n1 = _mm_add_ps(_mm_loadu_ps(r[1] + x), _mm_loadu_ps(r[3] + x));
+        __m128 n2 = _mm_add_ps(_mm_loadu_ps(r[0] + x), _mm_loadu_ps(r[4] + x));
+        __m128 v = _mm_add_ps(_mm_mul_ps(g0, c), _mm_add_ps(_mm_mul_ps(g1, n1), _mm_mul_ps(g2, n2)));
+        __m128i i32 = _mm_cvtps_epi32(v);
+        __m128i u16 = _mm_packus_epi32(i32, i32);
+        int packed = _mm_cvtsi128_si32(_mm_packus_epi16(u16, u16));
+        std::memcpy(dst + x, &packed, 4);
+    }
+    blurColumnsScalar(r, dst, w, g, x);
+}
+#endif
+
+static void lerpRows(const float* a, const float* b, const float alpha, float* out, const int w){
+#ifdef SIMD_X86
+    switch(simdLevel()){
+        case SIMD_AVX2: lerpRowsAVX2(a, b, alpha, out, w); return;
+        case SIMD_SSE41: lerpRowsSSE41(a, b, alpha, out, w); return;
+        default: break;
+    }
+#endif
+    lerpRowsScalar(a, b, alpha, out, w);
+}
+
+static void blurRow(const float* in, float* out, const int w, const float* g){
+#ifdef SIMD_X86
+    switch(simdLevel()){
+        case SIMD_AVX2: blurRowAVX2(in, out, w, g); return;
+        case SIMD_SSE41: blurRowSSE41(in, out, w, g); return;
+        default: break;
+    }
+#endif
+    blurRowScalar(in, out, w, g, 0, w);
+}
+
+static void blurColumns(const float* const* r, uchar* dst, const int w, const float* g){
+#ifdef SIMD_X86
+    switch(simdLevel()){
+        case SIMD_AVX2: blurColumnsAVX2(r, dst, w, g); return;
+        case SIMD_SSE41: blurColumnsSSE41(r, dst, w, g); return;
+        default: break;
+    }
+#endif
+    blurColumnsScalar(r, dst, w, g, 0);
+}
+
+PreprocessKernel::PreprocessKernel(){
+    gauss[0] = 1;
+    gauss[1] = 0;
+    gauss[2] = 0;
+}
+
+void PreprocessKernel::plan(const cv::Size src, const int dstWidth, const double sigma){
+    srcSize = src;
+    dstSize = cv::Size(dstWidth, (src.height/(double)src.width)*dstWidth);
+
+    // Same source coordinates as cv::resize with INTER_LINEAR
+    auto taps = [](const int srcLen, const int dstLen, std::vector<int>& ofs0, std::vector<int>& ofs1, std::vector<float>& alpha){
+        const double scale = 1.0/(dstLen/(double)srcLen);
+        ofs0.resize(dstLen);
+        ofs1.resize(dstLen);
+        alpha.resize(dstLen);
+        for(int d = 0; d < dstLen; d++){
+            float f = (float)((d + 0.5)*scale - 0.5);
+            int s = (int)std::floor(f);
+            f -= s;
+            if(s < 0){
+                s = 0;
+                f = 0;
+            }
+            if(s >= srcLen - 1){
+                s = srcLen - 1;
+                f = 0;
+            }
+            ofs0[d] = s;
+            ofs1[d] = std::min(s + 1, srcLen - 1);
+            alpha[d] = f;
+        }
+    };
+    taps(srcSize.width, dstSize.width, xOfs0, xOfs1, xAlpha);
+    taps(srcSize.height, dstSize.height, yOfs0, yOfs1, yAlpha);
+    for(int x = 0; x < dstSize.width; x++){ // offsets in bytes, 3 channels
+        xOfs0[x] *= 3;
+        xOfs1[x] *= 3;
+    }
+
+    // Same weights as cv::getGaussianKernel(5, sigma)
+    double sum = 0, w[3];
+    for(int d = 0; d < 3; d++){
+        w[d] = std::exp(-(d*d)/(2*sigma*sigma));
+        sum += d ? 2*w[d] : w[d];
+    }
+    for(int d = 0; d < 3; d++) gauss[d] = (float)(w[d]/sum);
+
+    // 2 resampled source rows, 1 resized row, 5 horizontally blurred rows
+    buffer.assign(8*dstSize.width, 0.f);
+}
+
+void PreprocessKernel::resampleRow(const uchar* src, float* dst)const{
+    for(int x = 0; x < dstSize.width; x++){
+        const uchar* p0 = src + xOfs0[x];
+        const uchar* p1 = src + xOfs1[x];
+        float g0 = 0.114f*p0[0] + 0.587f*p0[1] + 0.299f*p0[2];
+        float g1 = 0.114f*p1[0] + 0.587f*p1[1] + 0.299f*p1[2];
+        dst[x] = g0 + xAlpha[x]*(g1 - g0);
+    }
+}
+
+void PreprocessKernel::runRows(const cv::Mat& src, cv::Mat& dst, const int y0, const int y1, float* buf)const{
+    const int w = dstSize.width, h = dstSize.height;
+    float* taps[2] = {buf, buf + w}; // indexed by the parity of the source row
+    int tapRow[2] = {-1, -1};
+    float* line = buf + 2*w;
+    float* ring = buf + 3*w;
+
+    // Row r of the resized image is produced at step r, the output row r-2 can be blurred right after.
+    // The output rows [y0, y1) need the resized rows [y0 - 2, y1 + 2), reflected at the borders.
+    const int last = std::min(h - 1, y1 + 1);
+    for(int r = std::max(0, y0 - 2); r < y1 + 2; r++){
+        if(r <= last){
+            const int rows[2] = {yOfs0[r], yOfs1[r]};
+            for(int k = 0; k < 2; k++){
+                const int slot = rows[k] & 1;
+                if(tapRow[slot] != rows[k]){
+                    resampleRow(src.ptr<uchar>(rows[k]), taps[slot]);
+                    tapRow[slot] = rows[k];
+                }
+            }
+            lerpRows(taps[rows[0] & 1], taps[rows[1] & 1], yAlpha[r], line, w);
+            blurRow(line, ring + (r%5)*w, w, gauss);
+        }
+        const int y = r - 2;
+        if(y >= y0){
+            const float* rows5[5];
+            for(int k = -2; k <= 2; k++) rows5[k + 2] = ring + (reflect101(y + k, h)%5)*w;
+            blurColumns(rows5, dst.ptr<uchar>(y), w, gauss);
+        }
+    }
+}
+
+void PreprocessKernel::run(const cv::Mat& src, cv::Mat& dst, const int stripes, const ParallelFor& parallelFor){
+    const int w = dstSize.width, h = dstSize.height;
+    if(w < 3 || h < 3){ // too small for the 5x5 ring, use the OpenCV chain
+        cv::Mat resized;
+        cv::resize(src, resized, dstSize);
+        cv::cvtColor(resized, dst, cv::COLOR_BGR2GRAY);
+        cv::GaussianBlur(dst, dst, cv::Size(5,5), 0.3);
+        return;
+    }
+    dst.create(dstSize, CV_8UC1);
+    if(buffer.size() < (size_t)8*w*stripes) buffer.resize((size_t)8*w*stripes);
+
+    if(stripes <= 1){
+        runRows(src, dst, 0, h, buffer.data());
+        return;
+    }
+    parallelFor(stripes, [&](const int i){
+        int y0, y1;
+        stripeRows(i, stripes, h, y0, y1);
+        if(y0 < y1) runRows(src, dst, y0, y1, buffer.data() + (size_t)8*w*i);
+    });
+}
+
+cv::Size PreprocessKernel::inputSize()const{
+    return srcSize;
+}
+
+cv::Size PreprocessKernel::outputSize()const{
+    return dstSize;
+}
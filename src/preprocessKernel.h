@@ -0,0 +1,37 @@
+#ifndef __PREPROCESS_KERNEL__
+#define __PREPROCESS_KERNEL__
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include "stripes.h"
+
+#define PREPROCESS_MAX_ERROR 1 // gray levels from the OpenCV chain, the largest difference measured
+
+// Bilinear resize + BGR to gray + 5x5 Gaussian blur fused in a single pass over the cropped frame.
+// Every source row is read and converted to gray once; the intermediate rows live in a small
+// float buffer (two resampled source rows and a ring of five rows for the vertical blur).
+// The result stays within PREPROCESS_MAX_ERROR gray levels of the cv::resize/cvtColor/GaussianBlur chain: the chain
+// rounds after the resize and after the conversion, the kernel only at the end (checked by MultiCamSwitchBench).
+// The output can be split in horizontal stripes, each one with its own buffer: a stripe recomputes the two
+// resized rows above and below it, so the result does not depend on the number of stripes.
+class PreprocessKernel{
+private:
+    cv::Size srcSize;
+    cv::Size dstSize;
+    std::vector<int> xOfs0, xOfs1; // byte offsets of the two horizontal taps
+    std::vector<float> xAlpha;
+    std::vector<int> yOfs0, yOfs1; // source rows of the two vertical taps
+    std::vector<float> yAlpha;
+    float gauss[3]; // Gaussian weights for a distance of 0, 1 and 2 pixels
+    std::vector<float> buffer; // 8 rows per stripe
+    void resampleRow(const uchar* src, float* dst)const;
+    void runRows(const cv::Mat& src, cv::Mat& dst, const int y0, const int y1, float* buf)const;
+public:
+    PreprocessKernel();
+    void plan(const cv::Size src, const int dstWidth, const double sigma);
+    void run(const cv::Mat& src, cv::Mat& dst, const int stripes = 1, const ParallelFor& parallelFor = serialFor);
+    cv::Size inputSize()const;
+    cv::Size outputSize()const;
+};
+
+#endif
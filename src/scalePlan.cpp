@@ -0,0 +1,33 @@
+#include "scalePlan.h"
+#include <algorithm>
+
+ScalePlan ScalePlan::make(const cv::Size source, const cv::Size target){
+    ScalePlan plan;
+    plan.source = source;
+    plan.target = target;
+    // Cover: the side that fits exactly fixes the scale, the other one is cropped
+    double scale = std::max(target.width/(double)source.width, target.height/(double)source.height);
+    int width = std::min(source.width, std::max(1, (int)std::lround(target.width/scale)));
+    int height = std::min(source.height, std::max(1, (int)std::lround(target.height/scale)));
+    plan.roi = cv::Rect((source.width - width)/2, (source.height - height)/2, width, height);
+    plan.interpolation = scale < 1 ? cv::INTER_AREA : cv::INTER_LINEAR;
+    return plan;
+}
+
+void ScalePlan::apply(const cv::Mat& src, cv::Mat& dst)const{
+    // dst already has the target size: resize() writes into it without reallocating, views included
+    if(roi.size() == target) src(roi).copyTo(dst);
+    else cv::resize(src(roi), dst, target, 0.0, 0.0, interpolation);
+}
+
+const ScalePlan& ScalePlanCache::get(const cv::Size source, const cv::Size target){
+    for(const auto& plan : plans){
+        if(plan.source == source && plan.target == target) return plan;
+    }
+    plans.push_back(ScalePlan::make(source, target));
+    return plans.back();
+}
+
+size_t ScalePlanCache::size()const{
+    return plans.size();
+}
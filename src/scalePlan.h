@@ -0,0 +1,28 @@
+#ifndef __SCALE_PLAN__
+#define __SCALE_PLAN__
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+// How a source frame fills a destination of a fixed size: scaled to cover it and center cropped.
+// The crop is done on the source, so only the pixels that end up in the destination are resampled,
+// and the result is written straight into the destination (a pooled buffer or a region of the monitor).
+struct ScalePlan{
+    cv::Size source;
+    cv::Size target;
+    cv::Rect roi; // source pixels that survive the crop
+    int interpolation; // INTER_AREA when shrinking, INTER_LINEAR when enlarging
+    static ScalePlan make(const cv::Size source, const cv::Size target);
+    void apply(const cv::Mat& src, cv::Mat& dst)const; // dst must be target sized, it can be a view
+};
+
+// Plans computed once per (source size, target size) pair. Not thread safe: one cache per thread.
+class ScalePlanCache{
+private:
+    std::vector<ScalePlan> plans;
+public:
+    const ScalePlan& get(const cv::Size source, const cv::Size target);
+    size_t size()const;
+};
+
+#endif
@@ -7,6 +7,7 @@
 #include <thread>
 #include <chrono>
 #include <ctime>
+#include <iomanip>
 #include <opencv2/opencv.hpp>
 #include <opencv2/highgui.hpp>
 
@@ -19,13 +20,31 @@ Scene::Scene(const std::string configFilePath){
     smoothing = 20;
     fpsToFile = false;
     displayGeneralMonitor=false;
+    monitorFps = 10;
+    gatherDeadlineMs = 0;
+    alignTimestamps = false;
+    realtimeIngest = false;
+    ingestJitterMs = 0;
+    ingestDropRate = 0;
+    runSeconds = 0;
+    tickPts = -1;
     fpsFilePath = "../out/FPS.csv";
+    traceFilePath = ""; // no trace
+    metricsAddress = ""; // no metrics endpoint
+    outputFps = 0;
+    cuts = 0;
+    liveCapture = -1;
     camToAnalyzeCount = 0;
     method = nullptr;
-
-    //Init method labels
-    methodLabels.insert({{"FrameDiffAreaAndVel", &Capture::FrameDiffAreaAndVel},
-                         {"FrameDiffAreaOnly", &Capture::FrameDiffAreaOnly}});
+    ringDepth = 4;
+    ringPolicy = OVERFLOW_BLOCK;
+    encodeQueueDepth = 8;
+    lazyDecode = false;
+    thumbnailInterval = 1;
+    incrementalFlow = true;
+    backgroundFrames = 1 << BACKGROUND_SHIFT;
+    workerThreads = 0;
+    analysisStripes = 1;
 
 
     // Reading config File
@@ -51,21 +70,23 @@ Scene::Scene(const std::string configFilePath){
 
     //Init the general monitor with the right dimensions
     if(displayGeneralMonitor){
-        int height = 224 + 112*((captures.size()-1)/4);
-        generalMonitor = cv::Mat::zeros(cv::Size(1350, height),CV_8UC3);
-        outGeneralMonitor = cv::VideoWriter("../out/monitor.mp4", cv::VideoWriter::fourcc('m','p','4','v'),25, cv::Size(1350,height));
-        cv::namedWindow("General Monitor", cv::WINDOW_NORMAL);
-        cv::resizeWindow("General Monitor", 1350, height);
+        monitorCompositor.open(captures.size(), &outGeneralMonitor, encodeQueueDepth, monitorFps);
+        // The monitor is a debugging aid: drop its frames rather than slowing down the switching
+        outGeneralMonitor.open("../out/monitor.mp4", cv::VideoWriter::fourcc('m','p','4','v'),OUT_FPS, cv::Size(MONITOR_WIDTH, monitorCompositor.height()), encodeQueueDepth, OVERFLOW_DROP_NEWEST);
     }
 
-    // outVideo init
-    outVideo = cv::VideoWriter(outPath, cv::VideoWriter::fourcc('m','p','4','v'),25, cv::Size(outWidth,outHeight));
+    // outVideo init, every program frame is encoded
+    outPool.preallocate(encodeQueueDepth + 2, cv::Size(outWidth, outHeight), CV_8UC3); // queue, frame being encoded, lastOutput
+    if(!outVideo.open(outPath, cv::VideoWriter::fourcc('m','p','4','v'),OUT_FPS, cv::Size(outWidth,outHeight), encodeQueueDepth, OVERFLOW_BLOCK)){
+        std::cerr << "[OUT VIDEO OPENING ERROR]: " << outPath << std::endl;
+    }
 }
 
 Scene::~Scene(){
     if(fpsToFile) fpsStream.close();
     releaseCaps();
     outVideo.release();
+    monitorCompositor.release();
     outGeneralMonitor.release();
     cv::destroyAllWindows();
 }
@@ -82,19 +103,19 @@ void Scene::releaseCaps() const{
 
 void Scene::displayCaptures(){
     cv::destroyWindow("General Monitor");
+    startWorkers();
     for(auto& cap : captures){
-        threads.push_back(std::thread(&Capture::display, std::ref(*cap)));
-    }
-    for(auto& th : threads){ // Wait for each thread
-        th.join();
+        workers.submit([cap] {return cap->display();}, true); // each window stays on its worker
     }
+    workers.wait();
+    analysisWorkers.wait();
 }
 
 void Scene::readConfigFile(const std::string& configFilePath){
     std::string_view currentParsing; // What the program is currently parsing
     const std::vector<std::string_view> configFileLabels = {"[CAM_TO_ANALYZE]", "[CAM_TO_SHOW]","[ASSOCIATIONS]", "[OUT]", 
                                                             "[GENERAL]", "[CROP_COORDS]", "[WEIGHTS]", 
-                                                            "[DISPLAY_ANALYSIS]"}; 
+                                                            "[DISPLAY_ANALYSIS]", "[ANALYSIS_STRIDE]"}; 
     std::ifstream configFile(configFilePath);
     if (configFile.is_open()) {
         std::cout << "Reading configuration file..." << std::endl;
@@ -120,12 +141,6 @@ void Scene::readConfigFile(const std::string& configFilePath){
             std::string key = line.substr(0, delimiterPos); // key, before the = sign
             std::string value = line.substr(delimiterPos + 1); // value, after the = sign
             
-            // Check if the file exists
-            if(currentParsing == "[CAM_TO_ANALYZE]" || currentParsing == "[CAM_TO_SHOW]"){
-                std::ifstream file(value); 
-                if(!file.good()) throw std::invalid_argument("Error opening video stream " + value);
-            }
-
             // Create the caps
             if(currentParsing == "[CAM_TO_ANALYZE]"){
                 captures.push_back(std::make_shared<Capture>(key, value, true));
@@ -189,6 +204,22 @@ void Scene::readConfigFile(const std::string& configFilePath){
                 continue;
             }
 
+            if(currentParsing == "[ANALYSIS_STRIDE]"){
+                const int stride = std::stoi(value);
+                if(stride < 1) throw std::invalid_argument("The analysis stride '" + value + "' in '" + line + "' must be at least 1");
+                bool found = false;
+                for(const auto& cap : captures){
+                    if(cap->capName == key){
+                        if(!cap->analysis) throw std::invalid_argument("An analysis stride can only be assigned to analyzed cameras. '" + key + "' does not appear in the [CAM_TO_ANALYZE] section.");
+                        cap->setAnalysisStride(stride);
+                        found = true;
+                        break;
+                    }
+                }
+                if(!found) throw std::invalid_argument("The camera '" + key + "' in the [ANALYSIS_STRIDE] section must exist in the [CAM_TO_ANALYZE] section.");
+                continue;
+            }
+
             if(currentParsing == "[DISPLAY_ANALYSIS]"){
                 for(const auto& cap : captures) if(cap->capName == key && value == "true") cap->setDisplayAnalysis(true);
                 continue;
@@ -199,6 +230,11 @@ void Scene::readConfigFile(const std::string& configFilePath){
                 if(key == "outPath") outPath = value;
                 if(key == "width") outWidth = std::stoi(value);
                 if(key == "height") outHeight = std::stoi(value);
+                if(key == "encodeQueueDepth"){
+                    int tmp = std::stoi(value);
+                    if(tmp <= 0) throw std::invalid_argument("The encodeQueueDepth value '" + value + "' in '" + line + "' must be greater than 0");
+                    encodeQueueDepth = tmp;
+                }
                 continue;
             }
 
@@ -212,15 +248,97 @@ void Scene::readConfigFile(const std::string& configFilePath){
                 } 
                 if(key == "fpsToFile" && value == "true") fpsToFile = true;
                 if(key == "displayAllCaptures" && value == "true") displayGeneralMonitor=true;
+                if(key == "monitorFps"){
+                    double tmp = std::stod(value);
+                    if(tmp < 0) throw std::invalid_argument("The monitorFps value '" + value + "' in '" + line + "' must not be negative");
+                    monitorFps = tmp;
+                }
                 if(key == "fpsFilePath") fpsFilePath = value;
+                if(key == "traceFilePath") traceFilePath = value;
+                if(key == "metricsAddress") metricsAddress = value;
                 if(key == "alpha"){
                     double a = std::stod(value);
                     if(a <= -1 || a >= 1) throw std::invalid_argument("The alpha value '" + value + "' in '" + line + "' is not included in the ]-1,1[ interval");
                     else Capture::alpha = a;
                 }
+                if(key == "ringDepth"){
+                    int tmp = std::stoi(value);
+                    if(tmp <= 0) throw std::invalid_argument("The ringDepth value '" + value + "' in '" + line + "' must be greater than 0");
+                    ringDepth = tmp;
+                }
+                if(key == "ringOverflow"){
+                    if(value == "block") ringPolicy = OVERFLOW_BLOCK;
+                    else if(value == "dropOldest") ringPolicy = OVERFLOW_DROP_OLDEST;
+                    else if(value == "dropNewest") ringPolicy = OVERFLOW_DROP_NEWEST;
+                    else throw std::invalid_argument("Invalid ringOverflow policy '" + value + "' [block, dropOldest, dropNewest]");
+                }
+                if(key == "lazyDecode" && value == "true") lazyDecode = true;
+                if(key == "thumbnailInterval"){
+                    int tmp = std::stoi(value);
+                    if(tmp <= 0) throw std::invalid_argument("The thumbnailInterval value '" + value + "' in '" + line + "' must be greater than 0");
+                    thumbnailInterval = tmp;
+                }
+                if(key == "incrementalFlow" && value == "false") incrementalFlow = false;
+                if(key == "backgroundFrames"){
+                    int tmp = std::stoi(value);
+                    if(tmp < 2 || tmp > 256 || (tmp & (tmp - 1))) throw std::invalid_argument("The backgroundFrames value '" + value + "' in '" + line + "' must be a power of two between 2 and 256");
+                    backgroundFrames = tmp;
+                }
+                if(key == "strideMode"){
+                    if(value == "hold") Capture::strideMode = STRIDE_HOLD;
+                    else if(value == "interpolate") Capture::strideMode = STRIDE_INTERPOLATE;
+                    else throw std::invalid_argument("Invalid strideMode '" + value + "' [hold, interpolate]");
+                }
+                if(key == "strideShadow" && value == "true") Capture::strideShadow = true;
+                if(key == "motionGate"){
+                    double tmp = std::stod(value);
+                    if(tmp < 0) throw std::invalid_argument("The motionGate value '" + value + "' in '" + line + "' must not be negative");
+                    Capture::gateThreshold = tmp;
+                }
+                if(key == "gatherDeadlineMs"){
+                    double tmp = std::stod(value);
+                    if(tmp < 0) throw std::invalid_argument("The gatherDeadlineMs value '" + value + "' in '" + line + "' must not be negative");
+                    gatherDeadlineMs = tmp;
+                }
+                if(key == "alignTimestamps" && value == "true") alignTimestamps = true;
+                if(key == "realtimeIngest" && value == "true") realtimeIngest = true;
+                if(key == "ingestJitterMs"){
+                    double tmp = std::stod(value);
+                    if(tmp < 0) throw std::invalid_argument("The ingestJitterMs value '" + value + "' in '" + line + "' must not be negative");
+                    ingestJitterMs = tmp;
+                }
+                if(key == "ingestDropRate"){
+                    double tmp = std::stod(value);
+                    if(tmp < 0 || tmp >= 1) throw std::invalid_argument("The ingestDropRate value '" + value + "' in '" + line + "' is not included in the [0,1[ interval");
+                    ingestDropRate = tmp;
+                }
+                if(key == "workerThreads"){
+                    int tmp = std::stoi(value);
+                    if(tmp < 0) throw std::invalid_argument("The workerThreads value '" + value + "' in '" + line + "' must not be negative");
+                    workerThreads = tmp;
+                }
+                if(key == "analysisStripes"){
+                    int tmp = std::stoi(value);
+                    if(tmp < 0) throw std::invalid_argument("The analysisStripes value '" + value + "' in '" + line + "' must not be negative");
+                    analysisStripes = tmp;
+                }
+                if(key == "analysisCores"){
+                    // Comma separated list of CPU indexes
+                    std::size_t pos = 0;
+                    while(pos < value.size()){
+                        std::size_t nextPos = value.find(",", pos);
+                        if(nextPos == std::string::npos) nextPos = value.size();
+                        int cpu = std::stoi(value.substr(pos, nextPos - pos));
+                        const int cores = std::thread::hardware_concurrency(); // 0 if unknown
+                        if(cpu < 0 || (cores > 0 && cpu >= cores)) throw std::invalid_argument("The CPU '" + std::to_string(cpu) + "' in '" + line + "' does not exist");
+                        analysisCores.push_back(cpu);
+                        pos = nextPos + 1;
+                    }
+                }
                 if(key == "method"){
-                    for(const auto& [name, pointer] : methodLabels) if(name == value) method = pointer;
-                    if(method == nullptr) throw std::invalid_argument("Invalid switching method '" + value + "'");
+                    auto found = Capture::scoringMethods().find(value);
+                    if(found != Capture::scoringMethods().end()) method = &found->second;
+                    else throw std::invalid_argument("Invalid switching method '" + value + "'");
                 }
                 continue;
             } 
@@ -228,6 +346,26 @@ void Scene::readConfigFile(const std::string& configFilePath){
         configFile.close();
         checkAssociationsIntegrity();
         if(method == nullptr) throw std::invalid_argument("Switching method not defined! Please define it as follow:\nmethod=<switchingMethod>");
+        // The scene and the threads started from now on (decoders, encoders, monitor, debug views) leave the analysis cores free
+        keepThreadOffCpus(analysisCores);
+        openCaptures();
+        scoreboard.reset(captures.size());
+        for(int i = 0; i < captures.size(); i++) captures[i]->setScoreboard(&scoreboard, i);
+        for(const auto& cap : captures){
+            cap->setRing(ringDepth, ringPolicy);
+            cap->setRealtime(realtimeIngest, ingestJitterMs, ingestDropRate);
+            // With lazy decode the cameras to show decode a frame for the monitor thumbnails every thumbnailInterval frames
+            if(!cap->analysis) cap->setLazyDecode(lazyDecode, displayGeneralMonitor ? thumbnailInterval : 0);
+            else{
+                cap->setIncrementalFlow(incrementalFlow);
+                cap->setBackgroundFrames(backgroundFrames);
+                // The stripes of a frame run on the pool of the analysis task
+                TaskScheduler* pool = analysisCores.empty() ? &workers : &analysisWorkers;
+                const int poolThreads = analysisCores.empty() ? workerCount() : analysisCores.size();
+                int stripes = analysisStripes > 0 ? analysisStripes : std::max(1, poolThreads/camToAnalyzeCount);
+                cap->setStripes(stripes, [pool](const int count, const StripeBody& body) {pool->parallelFor(count, body);});
+            }
+        }
         std::cout << "Configuration read!" << std::endl;
     } else throw std::invalid_argument("Error while opening the config file. Check the config file name and path.\n--help for help.");
 }
@@ -239,104 +377,220 @@ void Scene::checkAssociationsIntegrity()const{
     }
 }
 
+void Scene::openCaptures(){
+    // Open and probe every source at the same time, the container probing dominates the startup
+    std::cout << "Opening " << captures.size() << " video streams..." << std::endl;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<std::string> errors(captures.size());
+    std::vector<std::thread> openers;
+    for(int i = 0; i < captures.size(); i++){
+        openers.emplace_back([this, i, &errors] {
+            try{
+                captures[i]->openSource();
+            } catch(const std::exception& e){
+                errors[i] = e.what();
+            } catch(...){
+                errors[i] = "Unknown error while opening the stream";
+            }
+        });
+    }
+    for(auto& opener : openers) opener.join();
+    const double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    // Every failure is reported, not only the first one
+    double serialMs = 0;
+    std::string failed;
+    int failures = 0;
+    for(int i = 0; i < captures.size(); i++){
+        const Capture& cap = *captures[i];
+        if(!errors[i].empty()){
+            failed += "\n  " + cap.capName + " (" + cap.source + "): " + errors[i];
+            failures++;
+            continue;
+        }
+        serialMs += cap.openMs + cap.probeMs;
+        std::cout << "  " << cap.capName << ": " << std::fixed << std::setprecision(1) << cap.openMs + cap.probeMs << " ms (open "
+                  << cap.openMs << " ms, probe " << cap.probeMs << " ms)" << std::endl;
+    }
+    if(failures > 0) throw std::invalid_argument(std::to_string(failures) + " of " + std::to_string(captures.size()) + " video streams could not be opened:" + failed);
+    std::cout << "Video streams opened in " << std::setprecision(1) << wallMs << " ms (" << serialMs << " ms one after the other)" << std::endl;
+}
+
+int Scene::workerCount()const{
+    if(workerThreads > 0) return workerThreads;
+    return std::max(1, (int)std::thread::hardware_concurrency() - 1 - (int)analysisCores.size());
+}
+
+void Scene::startWorkers(){
+    workers.start(workerCount(), {}, analysisCores); // the analysis cores run only the analysis workers
+    if(!analysisCores.empty()) analysisWorkers.start(0, analysisCores);
+}
+
 void Scene::cameraSwitch(){
-    // Start threads
+    // Start the workers and submit one task per capture
+    TRACE_THREAD_NAME("SCENE");
+    startWorkers();
+    if(displayGeneralMonitor) monitorCompositor.start(); // the scene submits the monitor updates from the first tick
     for(const auto& cap : captures){
-        if(cap->analysis) threads.push_back(std::thread(method, std::ref(*cap)));
-        else threads.push_back(std::thread(&Capture::grabFrame, std::ref(*cap))); // just grab frames for camera that are not analyzed
+        if(cap->analysis){
+            TaskScheduler& pool = analysisCores.empty() ? workers : analysisWorkers;
+            cap->startDebugView();
+            // The step is specialized for alpha and for the debug view of this camera
+            pool.submit([cap, m = method->select(cap->debugView() != nullptr)] {return ((*cap).*m)();});
+        }
+        else workers.submit([cap] {return cap->grabFrame();}); // just grab frames for camera that are not analyzed
+    }
+
+    if(!metricsAddress.empty()){
+        try{
+            metricsServer.start(metricsAddress, [this](std::ostream& os){writeMetrics(os);});
+            std::cout << "Metrics served at " << metricsAddress << "/metrics" << std::endl;
+        } catch(const std::exception& e){
+            std::cerr << "[METRICS]: " << e.what() << ", continuing without the metrics endpoint" << std::endl;
+        }
     }
 
     std::this_thread::sleep_for(std::chrono::milliseconds(200));
-    std::cout << "Threads started\nPress Ctrl+C to stop" << std::endl;
+    std::cout << "Workers started\nPress Ctrl+C to stop" << std::endl;
     
     uint frameNum = 0; // keep record of the processed frame number
-    std::chrono::time_point<std::chrono::system_clock> last_frame = std::chrono::system_clock::now();
+    std::chrono::steady_clock::time_point lastFrame = std::chrono::steady_clock::now();
     int selectedFrames[captures.size()] = { 0 }; // Save the selected frame index as if the switching were happening every frame
     int shownCaptureIndex = captures.size()-1; // Index of the analyzed winning camera
-    int fpsToDisplay = 0, fps = 0;
+    int fpsToDisplay = 0;
+    double fps = 0;
+    std::vector<FrameSlot> slots(captures.size()); // last frame retrieved from each capture
+    MonitorUpdate monitorUpdate; // references to the frames of the tick, for the monitor thread; its tiles are reused
+    heldSlots.assign(captures.size(), FrameSlot());
+    hasHeld.assign(captures.size(), false);
+    strideDivergence.votes.assign(camToAnalyzeCount, 0);
+    strideDivergence.fullVotes.assign(camToAnalyzeCount, 0);
+    cv::Mat lastFrameToshow; // last frame sent to the output
+    std::chrono::steady_clock::time_point lastCaptured; // capture time of lastFrameToshow
+    std::chrono::steady_clock::time_point runStart = std::chrono::steady_clock::now();
     
     while(1){
-        if(!isAtLeastOneActive(captures)) break;
-        if(displayGeneralMonitor && !(frameNum%15))clearGeneralMonitor();
+        if(!isAtLeastOneActive()) break;
+        TRACE_SCOPE(&sceneTrack, "tick");
 
         // Select the caps to show based on the cap that has the max score.
         double maxScore = 0;
         int selectedCapture = -1;
         int selectedAnalysisCapture = -1;
+        double maxFullScore = 0; // the same choice on the full rate scores (strideShadow)
+        int fullAnalysisCapture = -1;
         cv::Mat frameToshow;
+        std::chrono::steady_clock::time_point captured; // capture time of frameToshow, for the latency
+        // Cameras whose frame is not there by the deadline keep their previous one for this tick
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::microseconds((long long)(gatherDeadlineMs*1000));
+        if(displayGeneralMonitor){
+            monitorUpdate.tiles.resize(captures.size());
+            for(auto& tile : monitorUpdate.tiles) tile = MonitorTile(); // nothing left from the tick it was last used in
+        }
 
         for(int i = 0; i < captures.size(); i++){
-            if(captures[i]->active){
-                // Wait for the processed frame to be ready for this thread
-                std::unique_lock lk(captures[i]->mx);
-                captures[i]->condVar.wait(lk, [&] {return (captures[i]->readyToRetrieve || !captures[i]->active);});
-                
-                // Stop signal received
-                if(Capture::stopSignalReceived){
-                    captures[i]->readyToRetrieve = false;
-                    lk.unlock();
-                    captures[i]->condVar.notify_one();
-                    break;
-                } 
+            // Wait for the next frame of this capture, false if it has no more frames
+            if(!gatherFrame(i, slots[i], deadline)) continue;
+            
+            // Stop signal received
+            if(Capture::stopSignalReceived) break;
 
-                if(captures[i]->active && captures[i]->analysis){
-                    if(captures[i]->score > maxScore){ // find the maximum score
-                        maxScore = captures[i]->score;
-                        selectedAnalysisCapture = i;
-                    }
-                    if(selectedAnalysisCapture == -1 && i == camToAnalyzeCount-1){ // Last reached without a max score: force a frame
-                        selectedAnalysisCapture = i;
-                    } 
+            if(captures[i]->analysis){
+                if(slots[i].score > maxScore){ // find the maximum score
+                    maxScore = slots[i].score;
+                    selectedAnalysisCapture = i;
+                }
+                if(selectedAnalysisCapture == -1 && i == camToAnalyzeCount-1){ // Last reached without a max score: force a frame
+                    selectedAnalysisCapture = i;
                 } 
-                // Change the selected capture based on the associations matrix
-                if(selectedAnalysisCapture > -1) selectedCapture = associations[selectedAnalysisCapture][rand()%(associations[selectedAnalysisCapture].size())];
-                
-                // Copy the frame to show based on the associations
-                if(i == shownCaptureIndex) frameToshow = captures[i]->frame.clone();
-                
-                // Set the general monitor
-                if(displayGeneralMonitor) assembleGeneralMonitor(captures[i], frameNum, i == shownCaptureIndex, i, frameToshow);
-                // std::cout << "SCENE: " + std::to_string(camToAnalyze[i]->area) + " " +  std::to_string(camToAnalyze[i]->vel) + " " + std::to_string(camToAnalyze[i]->weight) + " " + std::to_string(camToAnalyze[i]->area_n) + " " + std::to_string(camToAnalyze[i]->score)<< std::endl;
-                captures[i]->readyToRetrieve = false;
-                lk.unlock();
-                captures[i]->condVar.notify_one();
+                if(Capture::strideShadow){
+                    if(slots[i].fullScore > maxFullScore){
+                        maxFullScore = slots[i].fullScore;
+                        fullAnalysisCapture = i;
+                    }
+                    if(fullAnalysisCapture == -1 && i == camToAnalyzeCount-1) fullAnalysisCapture = i;
+                    if(slots[i].fullScore >= 0){
+                        strideDivergence.scoreErrorSum += std::abs(slots[i].score - slots[i].fullScore);
+                        strideDivergence.fullScoreSum += slots[i].fullScore;
+                        strideDivergence.scoreSamples++;
+                    }
+                }
+            } 
+            // Change the selected capture based on the associations matrix
+            if(selectedAnalysisCapture > -1) selectedCapture = associations[selectedAnalysisCapture][rand()%(associations[selectedAnalysisCapture].size())];
+            
+            // Copy the frame to show based on the associations
+            // Right after a cut the queued frames of the new camera may not be decoded (lazy decode): keep the last one on air
+            if(i == shownCaptureIndex){
+                frameToshow = slots[i].frame.empty() ? lastFrameToshow : slots[i].frame; // shares the pooled buffer
+                captured = slots[i].frame.empty() ? lastCaptured : slots[i].captured;
             }
             
+            // Hand the frame to the general monitor
+            if(displayGeneralMonitor){
+                MonitorTile& tile = monitorUpdate.tiles[i];
+                if(!slots[i].stale) tile.frame = slots[i].frame; // a reused frame is already on the monitor
+                tile.analysis = captures[i]->analysis;
+                tile.weight = captures[i]->weight;
+                tile.score = slots[i].score;
+                tile.area = slots[i].area;
+                tile.vel = slots[i].vel;
+                tile.area_n = slots[i].area_n;
+            }
+        }
+
+        if(displayGeneralMonitor){
+            monitorUpdate.live = frameToshow;
+            monitorUpdate.liveIndex = shownCaptureIndex;
         }
 
         //Increment the selectedFrame count
         selectedFrames[selectedCapture]++;
+        if(Capture::strideShadow) compareStride(selectedAnalysisCapture, fullAnalysisCapture, frameNum % smoothing == 0);
 
         // Every "smooth" frames, the frame to display changes: update shownCaptureIndex
         // ShownCaptureIndex is updated taking into account what has happened since the last update
         if(frameNum % smoothing == 0){
-            shownCaptureIndex = std::distance(selectedFrames, std::max_element(selectedFrames, selectedFrames + captures.size()));
+            int winner = std::distance(selectedFrames, std::max_element(selectedFrames, selectedFrames + captures.size()));
+            if(winner != shownCaptureIndex) cuts.fetch_add(1, std::memory_order_relaxed);
+            shownCaptureIndex = winner;
+            liveCapture.store(shownCaptureIndex, std::memory_order_relaxed);
             std::fill(selectedFrames, selectedFrames + captures.size(), 0);
         }
+        lastFrameToshow = frameToshow;
+        lastCaptured = captured;
+
+        // Ask the cameras that may be on air in the next frames to decode them: the live one, the one
+        // selected in this frame and the one that is winning the vote for the next cut
+        if(lazyDecode){
+            int leadingCapture = std::distance(selectedFrames, std::max_element(selectedFrames, selectedFrames + captures.size()));
+            for(int i = 0; i < captures.size(); i++){
+                scoreboard.setDecodeWanted(i, i == shownCaptureIndex || i == selectedCapture || i == leadingCapture);
+            }
+        }
 
         // Check if a stop signal has been received
         if(Capture::stopSignalReceived){
-            for(auto& cap : captures){
-                cap->readyToRetrieve = false;
-                cap->condVar.notify_one();
-            }
+            for(auto& cap : captures) cap->ring.close(); // wake up the captures waiting for a free slot
             break;
         }
 
-        //Calculate the fps
-        std::chrono::duration<double> elapsed_seconds = std::chrono::system_clock::now()-last_frame;
-        fps = (int)(1/(elapsed_seconds.count()));
-        last_frame = std::chrono::system_clock::now();
+        //Calculate the fps on the monotonic clock, a wall clock adjustment would give a bogus sample
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        std::chrono::duration<double> elapsedSeconds = now - lastFrame;
+        lastFrame = now;
+        fps = elapsedSeconds.count() > 0 ? 1/elapsedSeconds.count() : 0;
+        outputFps.store(fps, std::memory_order_relaxed);
 
         //Update fpsToDisplay every 15 frames
-        if(!(frameNum % 15)) fpsToDisplay = fps;
-        if(fpsToFile && fps > 0 && fps < 3000) fpsStream << "\n" + std::to_string(fps);
+        if(!(frameNum % 15)) fpsToDisplay = (int)(fps + 0.5);
+        if(fpsToFile && fps > 0 && fps < 3000) fpsStream << "\n" << std::fixed << std::setprecision(2) << fps;
 
         //Output frame 
         try{
             //std::cout << "TEST " + std::to_string(frameNum) + "\n";
-            if(!frameToshow.empty())outputFrame(&(frameToshow), fpsToDisplay);
-            outputGeneralMonitor(&generalMonitor, fpsToDisplay);
+            TRACE_SCOPE(&sceneTrack, "output");
+            if(!frameToshow.empty())outputFrame(&(frameToshow), fpsToDisplay, captured);
         } catch(const cv::Exception& e){
             std::cerr << "[OUTPUT FRAME EXCEPTION]: " << e.what() << std::endl;
             Capture::stopSignalReceived = true;
@@ -344,116 +598,327 @@ void Scene::cameraSwitch(){
             std::cerr << "[OUTPUT FRAME EXCEPTION]: Unknown exception" << std::endl;
             Capture::stopSignalReceived = true;
         }
+        if(displayGeneralMonitor){
+            // Never waits: a busy monitor thread skips this tick. A closed window stops the monitor
+            monitorUpdate.frameNum = frameNum;
+            monitorUpdate.fps = fpsToDisplay;
+            if(!monitorCompositor.submit(monitorUpdate)) displayGeneralMonitor = monitorCompositor.isRunning();
+            // A skipped update must not hold the frames until the next tick
+            for(auto& tile : monitorUpdate.tiles) tile.frame.release();
+            monitorUpdate.live.release();
+        }
+        outPool.traffic.countFrame();
         frameNum++;
-    }
 
-    std::cout << "Waiting for threads to stop..." << std::endl;
-    // Join the threads
-    for(auto& th : threads){
-        th.join();
+        // Presentation time of the next tick, the first one starts from the latest camera
+        if(alignTimestamps){
+            if(tickPts < 0){
+                for(const auto& slot : slots) if(!slot.stale) tickPts = std::max(tickPts, slot.pts);
+            }
+            if(tickPts >= 0) tickPts += 1000.0/OUT_FPS;
+        }
     }
-    std::cout << "Threads joined" << std::endl;
-}
 
-bool Scene::isAtLeastOneActive(const std::vector<std::shared_ptr<Capture>>& caps)const{
-    // Check if at least one camera is active
-    bool atLeastOneActive = false;
-    for(const auto& cap : caps){ 
-        if(cap->active){
-            atLeastOneActive = true;
-            break;
-        } 
-    }
-    return atLeastOneActive;
+    runSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - runStart).count();
+    metricsServer.stop();
+    std::cout << "Waiting for the tasks to stop..." << std::endl;
+    // Wait for the capture tasks and join the workers
+    workers.wait();
+    analysisWorkers.wait();
+    std::cout << "Workers joined\n  " << workers << std::endl;
+    if(!analysisCores.empty()) std::cout << "  " << analysisWorkers << std::endl;
+    // Wait for the monitor and the encoders to write the queued frames
+    monitorCompositor.release();
+    outVideo.release();
+    outGeneralMonitor.release();
+    std::cout << "Encoders:\n  " << outVideo << "\n  " << outGeneralMonitor << "\n  " << monitorCompositor << std::endl;
+    printStats();
+    writeTrace();
 }
 
-void Scene::assembleGeneralMonitor(const std::shared_ptr<Capture>& cap, const int frameNum, const bool isLive, const int capNum, const cv::Mat& frameToShow){
-    cv::resize(cap->frame, cap->frame, cv::Size((cap->frame.cols/(double)(cap->frame.rows))*112, 112), 0.0,0.0, cv::INTER_AREA);
-    cap->frame = cap->frame(cv::Range(0, 112), cv::Range(cap->frame.cols/(double)2 - 99.5, cap->frame.cols/(double)2 + 99.5));
-    
-    if(isLive) cv::rectangle(cap->frame, cv::Rect(0,0, cap->frame.cols, cap->frame.rows), cv::Scalar(0,255,0), 4,8);
-    
-    // update text in the monitor
-    if(cap->analysis && !(frameNum%15)){
-        std::stringstream stream;
-        stream << std::fixed << std::setprecision(1) << cap->area;
-        std::vector<std::string> stats = {std::to_string(capNum + 1), 
-                                        std::to_string(cap->area_n),
-                                        stream.str()};
-        stream.str(std::string()); //clear the stream
-        stream << std::fixed << std::setprecision(2) << cap->vel;
-        stats.push_back(stream.str());
-        stats.push_back(std::to_string(cap->weight));
-        stream.str(std::string()); //clear the stream
-        stream << std::fixed << std::setprecision(1) << cap->score;
-        stats.push_back(stream.str());
-        for(int j = 0; j < stats.size(); j++){
-            cv::putText(generalMonitor, stats[j], cv::Point(810 + 90*j, 60 + capNum*30), cv::FONT_HERSHEY_PLAIN, 1.3, CV_RGB(230, 230, 230), 1, cv::LINE_AA);
+bool Scene::gatherFrame(const int i, FrameSlot& slot, const std::chrono::steady_clock::time_point deadline){
+    // Next frame of capture i for this tick. False if the capture has no more frames.
+    // A camera late for the deadline, or whose next frame belongs to a later tick, keeps its previous frame and score.
+    TRACE_SCOPE(&sceneTrack, "gather");
+    Capture& cap = *captures[i];
+    std::chrono::steady_clock::time_point waitStart = std::chrono::steady_clock::now();
+    const double halfTick = 500.0/OUT_FPS;
+    FrameSlot next;
+    bool got = false;
+    if(hasHeld[i]){
+        next = std::move(heldSlots[i]);
+        heldSlots[i] = FrameSlot();
+        hasHeld[i] = false;
+        got = true;
+    }
+    bool result = true;
+    while(1){
+        if(!got){
+            PopResult r = gatherDeadlineMs > 0 ? cap.ring.popUntil(next, deadline) : (cap.ring.pop(next) ? POP_OK : POP_CLOSED);
+            if(r == POP_CLOSED){
+                result = false;
+                break;
+            }
+            if(r == POP_TIMEOUT){
+                cap.stats.stalls.fetch_add(1, std::memory_order_relaxed);
+                cap.stats.substitutions.fetch_add(1, std::memory_order_relaxed);
+                slot.stale = true;
+                break;
+            }
+            got = true;
+        }
+        if(alignTimestamps && tickPts >= 0 && next.pts >= 0){
+            if(next.pts > tickPts + halfTick){ // belongs to a later tick
+                heldSlots[i] = std::move(next);
+                hasHeld[i] = true;
+                cap.stats.substitutions.fetch_add(1, std::memory_order_relaxed);
+                slot.stale = true;
+                break;
+            }
+            if(next.pts < tickPts - halfTick && cap.ring.size() > 0){ // behind: skip to a queued frame, never wait for it
+                cap.stats.alignDrops.fetch_add(1, std::memory_order_relaxed);
+                got = false;
+                continue;
+            }
         }
+        slot = std::move(next);
+        slot.stale = false;
+        break;
     }
-    cv::putText(cap->frame, std::to_string(capNum+1), cv::Point(6,20), cv::FONT_HERSHEY_PLAIN, 1.3, CV_RGB(230, 230, 230), 1, cv::LINE_AA);
-    int xOffset = capNum < 4 ? 398 + 199*(capNum%2) : 199*(capNum%4);
-    int yOffset = capNum < 4 ? 112*(capNum/2) : 224 + 112*((capNum-4)/4);
-    cap->frame.copyTo(generalMonitor.rowRange(yOffset, yOffset + 112).colRange(xOffset, xOffset + cap->frame.cols));
-    if(isLive){ // show the top left output
-        cv::Mat tmp = frameToShow.clone();
-        cv::resize(tmp, tmp, cv::Size((tmp.cols/(double)tmp.rows)*224, 224), 0.0,0.0, cv::INTER_AREA);
-        tmp = tmp(cv::Range(0, tmp.rows), cv::Range(tmp.cols/(double)2 - 199, tmp.cols/(double)2 + 199));
-        tmp.copyTo(generalMonitor.rowRange(0, tmp.rows).colRange(0, tmp.cols));
-    } 
+    cap.stats.gatherWaitNs.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - waitStart).count(), std::memory_order_relaxed);
+    return result;
 }
 
-void Scene::clearGeneralMonitor(){
-    generalMonitor = cv::Scalar(33,33,33);
-    cv::putText(generalMonitor, "CAM     N       A       V       W       S", cv::Point(810, 30), cv::FONT_HERSHEY_PLAIN, 1.3, CV_RGB(230, 230, 230), 1, cv::LINE_AA);
-    cv::putText(generalMonitor, "N = number of areas, A = area, V = avg speed", cv::Point(810, generalMonitor.rows - 24), cv::FONT_HERSHEY_PLAIN, 1, CV_RGB(230, 230, 230), 1, cv::LINE_AA);
-    cv::putText(generalMonitor, "W = frame weight, S = final score", cv::Point(810, generalMonitor.rows - 10), cv::FONT_HERSHEY_PLAIN, 1, CV_RGB(230, 230, 230), 1, cv::LINE_AA);
+void Scene::compareStride(const int strided, const int full, const bool windowEnd){
+    StrideDivergence& d = strideDivergence;
+    if(strided < 0 || full < 0) return;
+    d.frames++;
+    if(strided != full) d.leaderMismatches++;
+    d.votes[strided]++;
+    d.fullVotes[full]++;
+    // Same window as selectedFrames: the vote decides the next cut
+    if(windowEnd){
+        d.windows++;
+        if(std::max_element(d.votes.begin(), d.votes.end()) - d.votes.begin() != std::max_element(d.fullVotes.begin(), d.fullVotes.end()) - d.fullVotes.begin()) d.voteMismatches++;
+        std::fill(d.votes.begin(), d.votes.end(), 0);
+        std::fill(d.fullVotes.begin(), d.fullVotes.end(), 0);
+    }
 }
 
-void Scene::outputGeneralMonitor(cv::Mat* frame, int fps){
-    if(displayGeneralMonitor){
-        outGeneralMonitor.write(*frame);
-        cv::waitKey(1);
-        if(!getWindowProperty("General Monitor", cv::WND_PROP_VISIBLE)) displayGeneralMonitor = false;
-        else{
-            cv::putText(generalMonitor, "FPS: " + std::to_string(fps), cv::Point(810, generalMonitor.rows - 45), cv::FONT_HERSHEY_PLAIN, 1.2, CV_RGB(230, 230, 230), 1, cv::LINE_AA);
-            cv::imshow("General Monitor", *frame);
+bool Scene::isAtLeastOneActive()const{
+    // Check if at least one camera is active or still has frames to retrieve
+    bool atLeastOneActive = false;
+    for(int i = 0; i < captures.size(); i++){
+        if(scoreboard.isActive(i) || !captures[i]->ring.isDrained()){
+            atLeastOneActive = true;
+            break;
         } 
     }
+    return atLeastOneActive;
 }
 
-void Scene::outputFrame(cv::Mat* frame, int fps){
-    // Resize and crop
-    double ratio = frame->cols/(double)(frame->rows);
-    if(ratio*outHeight >= outWidth){ // resize fixed height
-        cv::resize(*frame, *frame, cv::Size((frame->cols/(double)(frame->rows))*outHeight, outHeight), 0.0, 0.0, cv::INTER_AREA);
-        //Crop to out dimensions
-        (*frame) = (*frame)(cv::Range(0, outHeight), cv::Range(frame->cols/2 - outWidth/2, frame->cols/2 + outWidth/2));
-    } else { // resize fixed width
-        cv::resize(*frame, *frame, cv::Size(outWidth, (frame->rows/(double)frame->cols)*outWidth), 0.0, 0.0, cv::INTER_AREA);
-        //Crop to out dimensions
-        (*frame) = (*frame)(cv::Range(frame->rows/2 - outHeight/2, frame->rows/2 + outHeight/2), cv::Range(0, outWidth));
+void Scene::outputFrame(cv::Mat* frame, int fps, const std::chrono::steady_clock::time_point captured){
+    // Crop and resize straight into a buffer of the encoder. The frame is shared with the capture pool: it is only read
+    cv::Mat writeFrame = outPool.acquire();
+    scalePlans.get(frame->size(), writeFrame.size()).apply(*frame, writeFrame);
+    outPool.traffic.countCopy(writeFrame);
+    lastOutput = writeFrame;
+    cv::Mat outFrame = writeFrame; // read only from now on, the encoder owns the pixels
+    {
+        TRACE_SCOPE(&sceneTrack, "encodeQueue");
+        outVideo.write(writeFrame, captured); // the encoder measures the latency from the capture
     }
-    
-    cv::Mat writeFrame = frame->clone();
-    // Write to the stream
-    outVideo.write(writeFrame);
     if(displayOutput){
         cv::namedWindow("OUT", cv::WINDOW_AUTOSIZE);
         cv::waitKey(1);
         if(!getWindowProperty("OUT", cv::WND_PROP_VISIBLE)) displayOutput = false;
         else{
             //Resize for displaying
-            cv::resize(*frame, *frame, cv::Size(1200,(frame->rows/(double)frame->cols)*1200));
+            cv::resize(outFrame, displayFrame, cv::Size(1200,(outFrame.rows/(double)outFrame.cols)*1200));
             //FPS LABEL
-            cv::putText(*frame, //target image
+            cv::putText(displayFrame, //target image
             "FPS: " + std::to_string(fps), //text
             cv::Point(10, 40), //top-left position
             cv::FONT_HERSHEY_SIMPLEX,
             1.0,
             CV_RGB(0, 255, 0), //font color
             2);
-            cv::imshow("OUT", *frame);
+            cv::imshow("OUT", displayFrame);
         } 
     }
 }
+
+void Scene::printStats()const{
+    std::cout << "Decoded frames:" << std::endl;
+    for(const auto& cap : captures){
+        std::cout << "  " << cap->capName << ": " << cap->stats.decodedFrames << " decoded, " << cap->stats.skippedFrames << " skipped" << std::endl;
+    }
+    std::cout << "Frame traffic (per frame):" << std::endl;
+    for(const auto& cap : captures){
+        std::cout << "  " << cap->capName << ": " << std::fixed << std::setprecision(1) << cap->framePool.traffic.bytesCopiedPerFrame() 
+                  << " bytes copied, " << std::setprecision(3) << cap->framePool.traffic.buffersAllocatedPerFrame() << " buffers allocated, "
+                  << cap->framePool.size() << " pooled buffers" << std::endl;
+    }
+    std::cout << "  OUT: " << std::fixed << std::setprecision(1) << outPool.traffic.bytesCopiedPerFrame() << " bytes copied, " 
+              << std::setprecision(3) << outPool.traffic.buffersAllocatedPerFrame() << " buffers allocated" << std::endl;
+    std::cout << "Analysis (preprocessing, differencing, blobs):" << std::endl;
+    for(const auto& cap : captures){
+        if(!cap->analysis) continue;
+        std::cout << "  " << cap->capName << ": " << std::setprecision(3) << cap->stats.meanAnalysisMs() << " ms/frame, " << cap->stats.analyzedFrames << " frames analyzed" << std::endl;
+    }
+    if(AllocCounter::enabled()){
+        std::cout << "Heap allocations per frame, after the first " << ALLOC_WARMUP_FRAMES << " frames:" << std::endl;
+        for(const auto& cap : captures){
+            const unsigned long long frames = cap->stats.steadyFrames;
+            std::cout << "  " << cap->capName << ": " << std::setprecision(3) << (frames ? cap->stats.steadyAllocations/(double)frames : 0) << " by the steps ("
+                      << cap->stats.allocatingFrames << "/" << frames << " frames allocating), "
+                      << (frames ? cap->stats.foreignAllocations/(double)frames : 0) << " by the decoder and OpenCV" << std::endl;
+        }
+    }
+    if(Capture::gateThreshold > 0){
+        std::cout << "Motion gate (mean difference above " << std::setprecision(1) << Capture::gateThreshold << " per tile):" << std::endl;
+        for(const auto& cap : captures){
+            if(!cap->analysis) continue;
+            const unsigned long long tiles = cap->stats.gateTiles;
+            std::cout << "  " << cap->capName << ": " << cap->stats.gatedFrames << "/" << cap->stats.analyzedFrames << " frames without motion, "
+                      << (tiles ? 100.0*cap->stats.gatedTiles/tiles : 0) << "% of the tiles not differenced" << std::endl;
+        }
+    }
+    if(Capture::strideShadow){
+        const StrideDivergence& d = strideDivergence;
+        std::cout << "Analysis stride against full rate (" << (Capture::strideMode == STRIDE_HOLD ? "hold" : "interpolate") << "):" << std::endl
+                  << "  leading camera differs in " << d.leaderMismatches << "/" << d.frames << " frames ("
+                  << std::setprecision(1) << (d.frames ? 100.0*d.leaderMismatches/d.frames : 0) << "%)" << std::endl
+                  << "  vote winner differs in " << d.voteMismatches << "/" << d.windows << " windows ("
+                  << (d.windows ? 100.0*d.voteMismatches/d.windows : 0) << "%)" << std::endl
+                  << "  mean score error " << std::setprecision(3) << (d.scoreSamples ? d.scoreErrorSum/d.scoreSamples : 0)
+                  << " (" << std::setprecision(1) << (d.fullScoreSum > 0 ? 100*d.scoreErrorSum/d.fullScoreSum : 0) << "% of the mean score)" << std::endl;
+    }
+    std::cout << "Gather (" << (gatherDeadlineMs > 0 ? "deadline " + std::to_string((int)gatherDeadlineMs) + " ms" : "lockstep")
+              << (alignTimestamps ? ", aligned by timestamp" : "") << "):" << std::endl;
+    for(const auto& cap : captures){
+        std::cout << "  " << cap->capName << ": " << std::setprecision(3) << cap->stats.gatherWaitNs/1e6 << " ms waited, "
+                  << cap->stats.stalls << " stalls, " << cap->stats.substitutions << " substitutions, "
+                  << cap->stats.alignDrops << " frames dropped to catch up" << std::endl;
+    }
+    const LatencyHistogram& latency = outVideo.glassToGlass();
+    std::cout << "Glass to glass latency (" << (realtimeIngest ? "realtime ingest, from the due time of the frame" : "from the decoding of the frame")
+              << " to the frame encoded):" << std::endl
+              << "  p50 " << std::setprecision(1) << latency.percentile(0.5)/1e6 << " ms, p90 " << latency.percentile(0.9)/1e6
+              << " ms, p99 " << latency.percentile(0.99)/1e6 << " ms, max " << latency.max()/1e6 << " ms, last "
+              << outVideo.lastLatencySeconds()*1000 << " ms over " << latency.count() << " frames" << std::endl;
+    if(realtimeIngest){
+        // Keeping up: the output runs at the rate of the sources and the latency does not grow over the run
+        std::cout << "Realtime ingest (jitter " << ingestJitterMs << " ms, drop rate " << std::setprecision(3) << ingestDropRate << "):" << std::endl
+                  << "  output " << std::setprecision(2) << (runSeconds > 0 ? outPool.traffic.frames/runSeconds : 0) << " fps over " << runSeconds << " s" << std::endl;
+        for(const auto& cap : captures){
+            std::cout << "  " << cap->capName << ": paced at " << cap->frameRate() << " fps, " << cap->stats.injectedDrops << " frames lost" << std::endl;
+        }
+    }
+    for(const auto& cap : captures){
+        if(cap->debugView() != nullptr) std::cout << "Debug view:\n  " << *cap->debugView() << std::endl;
+    }
+    std::cout << "Speed stage (" << (incrementalFlow ? "incremental" : "full") << " optical flow):" << std::endl;
+    for(const auto& cap : captures){
+        const FlowStats& flow = cap->flowStats();
+        if(!cap->analysis || flow.frames == 0) continue;
+        std::cout << "  " << cap->capName << ": " << std::setprecision(3) << flow.meanMs() << " ms/frame, "
+                  << flow.lkPoints << " points with Lucas-Kanade, " << flow.trackedPoints << " tracked without it, "
+                  << flow.pyramidsBuilt << " pyramids built" << std::endl;
+    }
+}
+
+void Scene::writeTrace()const{
+    if(traceFilePath.empty()) return;
+    if(!Tracer::enabled()){
+        std::cout << "Tracing is not compiled in (cmake -DMULTICAMSWITCH_TRACE=ON), " << traceFilePath << " not written" << std::endl;
+        return;
+    }
+    std::vector<const TraceTrack*> tracks;
+    for(const auto& cap : captures) tracks.push_back(&cap->trace);
+    tracks.push_back(&sceneTrack);
+    tracks.push_back(&outVideo.trace);
+    tracks.push_back(&outGeneralMonitor.trace);
+    tracks.push_back(&monitorCompositor.trace);
+    if(!Tracer::dump(traceFilePath, tracks)){
+        std::cerr << "Unable to write the trace to " << traceFilePath << std::endl;
+        return;
+    }
+    std::cout << "\nStage latency (trace in " << traceFilePath << "):" << std::endl;
+    for(const TraceTrack* track : tracks) std::cout << "  " << *track << std::endl;
+}
+
+void Scene::writeMetrics(std::ostream& os)const{
+    // Everything read here is an atomic updated by the cameras, the scene or the encoders: no locks
+    MetricsWriter m(os);
+    const std::string prefix = "multicamswitch_";
+    struct CameraCounter{
+        const char* name;
+        const char* type;
+        const char* help;
+        std::function<double(const Capture&, const CameraState&)> value; // the state read once per camera
+    };
+    const std::vector<CameraCounter> cameraMetrics = {
+        {"decoded_frames_total", "counter", "Frames decoded", [](const Capture& c, const CameraState&){return (double)c.stats.decodedFrames.load(std::memory_order_relaxed);}},
+        {"skipped_frames_total", "counter", "Frames grabbed but not decoded (lazy decode)", [](const Capture& c, const CameraState&){return (double)c.stats.skippedFrames.load(std::memory_order_relaxed);}},
+        {"analyzed_frames_total", "counter", "Frames analyzed", [](const Capture& c, const CameraState&){return (double)c.stats.analyzedFrames.load(std::memory_order_relaxed);}},
+        {"dropped_frames_total", "counter", "Frames dropped by the ring overflow policy", [](const Capture& c, const CameraState&){return (double)c.ring.droppedCount();}},
+        {"analysis_seconds_total", "counter", "Time spent analyzing the frames", [](const Capture& c, const CameraState&){return c.stats.analysisNs.load(std::memory_order_relaxed)/1e9;}},
+        {"ring_full_backoffs_total", "counter", "Steps that backed off because the scene had not taken the previous frames", [](const Capture& c, const CameraState&){return (double)c.stats.ringFullBackoffs.load(std::memory_order_relaxed);}},
+        {"gather_wait_seconds_total", "counter", "Time the scene waited for the frames of the camera", [](const Capture& c, const CameraState&){return c.stats.gatherWaitNs.load(std::memory_order_relaxed)/1e9;}},
+        {"stalls_total", "counter", "Ticks the camera missed the gather deadline", [](const Capture& c, const CameraState&){return (double)c.stats.stalls.load(std::memory_order_relaxed);}},
+        {"substitutions_total", "counter", "Ticks served with the previous frame of the camera", [](const Capture& c, const CameraState&){return (double)c.stats.substitutions.load(std::memory_order_relaxed);}},
+        {"align_drops_total", "counter", "Frames dropped to catch up with the timestamp of the tick", [](const Capture& c, const CameraState&){return (double)c.stats.alignDrops.load(std::memory_order_relaxed);}},
+        {"gated_frames_total", "counter", "Analyzed frames without any changed tile (motion gate)", [](const Capture& c, const CameraState&){return (double)c.stats.gatedFrames.load(std::memory_order_relaxed);}},
+        {"gate_tiles_total", "counter", "Tiles checked by the motion gate", [](const Capture& c, const CameraState&){return (double)c.stats.gateTiles.load(std::memory_order_relaxed);}},
+        {"gated_tiles_total", "counter", "Tiles left out of the frame differencing by the motion gate", [](const Capture& c, const CameraState&){return (double)c.stats.gatedTiles.load(std::memory_order_relaxed);}},
+        {"steady_allocations_total", "counter", "Heap allocations of the capture steps after the warm up (MULTICAMSWITCH_ALLOC_COUNTING builds)", [](const Capture& c, const CameraState&){return (double)c.stats.steadyAllocations.load(std::memory_order_relaxed);}},
+        {"foreign_allocations_total", "counter", "Heap allocations of the decoder and OpenCV after the warm up (MULTICAMSWITCH_ALLOC_COUNTING builds)", [](const Capture& c, const CameraState&){return (double)c.stats.foreignAllocations.load(std::memory_order_relaxed);}},
+        {"injected_drops_total", "counter", "Frames lost by the emulated live source (realtime ingest)", [](const Capture& c, const CameraState&){return (double)c.stats.injectedDrops.load(std::memory_order_relaxed);}},
+        {"ring_depth", "gauge", "Frames waiting for the scene", [](const Capture& c, const CameraState&){return (double)c.ring.size();}},
+        {"score", "gauge", "Score of the last frame", [](const Capture&, const CameraState& s){return s.score;}},
+        {"area", "gauge", "Motion area of the last frame", [](const Capture&, const CameraState& s){return s.area;}},
+        {"blobs", "gauge", "Blobs counted in the motion area of the last frame", [](const Capture&, const CameraState& s){return (double)s.area_n;}},
+        {"vel", "gauge", "Mean speed of the blobs in the last frame", [](const Capture&, const CameraState& s){return s.vel;}},
+        {"active", "gauge", "1 while the camera is producing frames", [](const Capture&, const CameraState& s){return s.active ? 1.0 : 0.0;}},
+    };
+    // Score, area and speed of a camera from the same frame, even if it delivers one while the page is written
+    std::vector<CameraState> states(captures.size());
+    for(int i = 0; i < captures.size(); i++) states[i] = scoreboard.read(i);
+    const int live = liveCapture.load(std::memory_order_relaxed);
+    for(const CameraCounter& metric : cameraMetrics){
+        m.family(prefix + "camera_" + metric.name, metric.type, metric.help);
+        for(int i = 0; i < captures.size(); i++){
+            m.sample(prefix + "camera_" + metric.name, MetricsWriter::label("camera", captures[i]->capName), metric.value(*captures[i], states[i]));
+        }
+    }
+    m.family(prefix + "camera_live", "gauge", "1 for the camera on air");
+    for(int i = 0; i < captures.size(); i++) m.sample(prefix + "camera_live", MetricsWriter::label("camera", captures[i]->capName), (unsigned long long)(i == live));
+
+    m.family(prefix + "output_fps", "gauge", "Frames per second of the switching loop");
+    m.sample(prefix + "output_fps", "", outputFps.load(std::memory_order_relaxed));
+    m.family(prefix + "output_frames_total", "counter", "Frames produced by the switching loop");
+    m.sample(prefix + "output_frames_total", "", outPool.traffic.frames.load(std::memory_order_relaxed));
+    m.family(prefix + "cuts_total", "counter", "Changes of the camera on air");
+    m.sample(prefix + "cuts_total", "", cuts.load(std::memory_order_relaxed));
+
+    m.family(prefix + "glass_to_glass_seconds", "summary", "Time from the capture of the frame on air to the frame encoded");
+    m.sample(prefix + "glass_to_glass_seconds_sum", "", outVideo.latencySumSeconds());
+    m.sample(prefix + "glass_to_glass_seconds_count", "", outVideo.latencySamples());
+    m.family(prefix + "glass_to_glass_last_seconds", "gauge", "Latency of the last frame encoded");
+    m.sample(prefix + "glass_to_glass_last_seconds", "", outVideo.lastLatencySeconds());
+
+    const AsyncVideoWriter* encoders[] = {&outVideo, &outGeneralMonitor};
+    const char* encoderNames[] = {"out", "monitor"};
+    m.family(prefix + "encoder_queue_depth", "gauge", "Frames waiting to be encoded");
+    for(int i = 0; i < 2; i++) m.sample(prefix + "encoder_queue_depth", MetricsWriter::label("encoder", encoderNames[i]), (unsigned long long)encoders[i]->queueDepth());
+    m.family(prefix + "encoder_backlog_frames", "gauge", "Frames queued but not written yet");
+    for(int i = 0; i < 2; i++){
+        const unsigned long long queued = encoders[i]->queuedCount(), written = encoders[i]->writtenCount();
+        m.sample(prefix + "encoder_backlog_frames", MetricsWriter::label("encoder", encoderNames[i]), queued > written ? queued - written : 0ULL);
+    }
+    m.family(prefix + "encoder_written_frames_total", "counter", "Frames written to the file");
+    for(int i = 0; i < 2; i++) m.sample(prefix + "encoder_written_frames_total", MetricsWriter::label("encoder", encoderNames[i]), encoders[i]->writtenCount());
+    m.family(prefix + "encoder_dropped_frames_total", "counter", "Frames dropped by the encoder queue");
+    for(int i = 0; i < 2; i++) m.sample(prefix + "encoder_dropped_frames_total", MetricsWriter::label("encoder", encoderNames[i]), encoders[i]->droppedCount());
+}
@@ -2,6 +2,12 @@
 #define __SCENE__
 
 #include "capture.h"
+#include "asyncVideoWriter.h"
+#include "taskScheduler.h"
+#include "trace.h"
+#include "metricsServer.h"
+#include "scalePlan.h"
+#include "monitorCompositor.h"
 #include <iostream>
 #include <fstream>
 #include <string>
@@ -9,15 +15,31 @@
 #include <memory>
 #include <mutex>
 #include <thread>
+#include <atomic>
+#include <functional>
 
 #define MONITOR_BORDER 5
+#define OUT_FPS 25 // frame rate of the output videos, one cameraSwitch tick per frame
 
 typedef enum CameraType{
     TOP = 1,
     LATERAL = 2
 }CameraType;
 
+// Cut decisions taken on the strided scores against the ones the full rate analysis would take (strideShadow)
+struct StrideDivergence{
+    unsigned long long frames = 0;
+    unsigned long long leaderMismatches = 0; // frames whose highest scoring analyzed camera differs
+    unsigned long long windows = 0;
+    unsigned long long voteMismatches = 0; // smoothing windows whose vote winner differs
+    double scoreErrorSum = 0; // sum of |strided score - full rate score|
+    double fullScoreSum = 0;
+    unsigned long long scoreSamples = 0;
+    std::vector<int> votes, fullVotes; // per analyzed camera, current window
+};
+
 class Scene{
+    friend class KernelBench; // bench/kernelBench.cpp measures the private stages
 public:
     Scene(const std::string configFilePath);
     ~Scene();
@@ -26,32 +48,70 @@ public:
     void cameraSwitch();
 private:
     std::vector<std::shared_ptr<Capture>> captures; // cameras to analyzed and to show defined in the config file
-    std::vector<std::thread> threads; // threads used for doing the capture computations 
+    Scoreboard scoreboard; // state of the cameras, one line of captures[i] each
+    TaskScheduler workers{"WORKERS"}; // run the capture tasks
+    TaskScheduler analysisWorkers{"ANALYSIS"}; // run the analysis tasks when analysisCores is set
+    int workerThreads; // 0 = one per core, the scene thread excluded
+    std::vector<int> analysisCores; // cores reserved to the analysis cameras, one pinned worker each
+    int analysisStripes; // stripes each analyzed frame is split in, 0 = spread the analysis workers over the cameras
     std::vector<std::vector<int>> associations;
-    std::map<std::string_view, void (Capture::*)()> methodLabels;
     std::string outPath; // Path of the out stream
     int camToAnalyzeCount;
     int camToShowCount;
     int outWidth;
     int outHeight;
     bool displayOutput;
-    void (Capture::*method)(); // Function pointer to the method used for the camera switching
-    cv::VideoWriter outVideo;
-    cv::VideoWriter outGeneralMonitor;
+    const ScoringMethod* method; // scoring method of the analyzed cameras, from Capture::scoringMethods()
+    AsyncVideoWriter outVideo{"OUT"}; // the encoders run on their own threads
+    AsyncVideoWriter outGeneralMonitor{"MONITOR"};
+    int encodeQueueDepth; // frames waiting for each encoder
+    FramePool outPool; // buffers handed to the encoder, its traffic counts the frames and copies of the output path
     int smoothing;
+    int ringDepth; // number of frames a capture can produce ahead of the switching loop
+    OverflowPolicy ringPolicy;
     bool fpsToFile;
     bool displayGeneralMonitor;
-    cv::Mat generalMonitor;
+    MonitorCompositor monitorCompositor; // composes, encodes and shows the general monitor on its own thread
+    double monitorFps; // refresh rate of the general monitor window, 0 = no window
+    bool lazyDecode; // cameras to show decode only the frames that can be shown
+    int thumbnailInterval; // with lazyDecode, frames between two thumbnail updates of a camera that is not on air
+    bool incrementalFlow; // track the blobs between frames, Lucas-Kanade only on the new ones
+    int backgroundFrames; // time constant of the background model (BackgroundModelArea), in analyzed frames
+    StrideDivergence strideDivergence; // filled by the scene thread with Capture::strideShadow
+    double gatherDeadlineMs; // longest wait for the frames of a tick, 0 = wait for every camera (lockstep)
+    bool alignTimestamps; // pair the frames by presentation timestamp instead of by arrival order
+    bool realtimeIngest; // read the files like live cameras, at their native frame rate
+    double ingestJitterMs; // realtime ingest: each frame arrives up to ingestJitterMs late
+    double ingestDropRate; // realtime ingest: fraction of the frames the sources lose
+    double runSeconds; // duration of the switching loop
+    double tickPts; // presentation time of the current tick (ms), -1 until the first tick
+    std::vector<FrameSlot> heldSlots; // frames ahead of the tick, kept for a later one
+    std::vector<char> hasHeld;
+    ScalePlanCache scalePlans; // output, preview and thumbnail scaling, per source resolution
+    cv::Mat lastOutput; // last frame handed to the encoder
+    cv::Mat displayFrame; // output window scratch buffer
     std::string fpsFilePath;
+    std::string traceFilePath; // Chrome trace of the run, written when the build has MULTICAMSWITCH_TRACE
+    TraceTrack sceneTrack{"SCENE"}; // stage latencies of the scene thread
+    std::string metricsAddress; // host:port or unix:path of the metrics endpoint, empty = disabled
+    MetricsServer metricsServer;
+    std::atomic<double> outputFps; // read by the metrics server
+    std::atomic<unsigned long long> cuts; // changes of the camera on air
+    std::atomic<int> liveCapture; // index of the camera on air
     std::ofstream fpsStream;
-    bool isAtLeastOneActive(const std::vector<std::shared_ptr<Capture>>& caps)const;
+    bool isAtLeastOneActive()const;
     void readConfigFile(const std::string& configFilePath);
     void checkAssociationsIntegrity()const;
+    void openCaptures();
     void releaseCaps()const;
-    void clearGeneralMonitor();
-    void assembleGeneralMonitor(const std::shared_ptr<Capture>& cap, const int frameNum, const bool isLive, const int capNum, const cv::Mat& frameToShow);
-    void outputGeneralMonitor(cv::Mat* frame, int fps);
-    void outputFrame(cv::Mat* frame, int fps);
+    int workerCount()const;
+    void startWorkers();
+    void outputFrame(cv::Mat* frame, int fps, const std::chrono::steady_clock::time_point captured);
+    void printStats()const;
+    void writeTrace()const;
+    bool gatherFrame(const int i, FrameSlot& slot, const std::chrono::steady_clock::time_point deadline);
+    void compareStride(const int strided, const int full, const bool windowEnd);
+    void writeMetrics(std::ostream& os)const; // only reads atomics, called by the metrics server
 };
 
 #endif
@@ -0,0 +1,63 @@
+#include "scoreboard.h"
+
+Scoreboard::Scoreboard(){
+    count = 0;
+}
+
+void Scoreboard::reset(const int n){
+    cameras.reset(new CameraLine[n]);
+    scene.reset(new SceneLine[n]);
+    count = n;
+    for(int i = 0; i < n; i++) cameras[i].active.store(true, std::memory_order_relaxed);
+}
+
+int Scoreboard::size()const{
+    return count;
+}
+
+void Scoreboard::publish(const int camera, const double score, const double area, const double vel, const int area_n, const unsigned int frameNum){
+    CameraLine& line = cameras[camera];
+    const unsigned int seq = line.seq.load(std::memory_order_relaxed);
+    line.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release); // the odd sequence is visible before any of the values
+    line.score.store(score, std::memory_order_relaxed);
+    line.area.store(area, std::memory_order_relaxed);
+    line.vel.store(vel, std::memory_order_relaxed);
+    line.area_n.store(area_n, std::memory_order_relaxed);
+    line.frameNum.store(frameNum, std::memory_order_relaxed);
+    line.seq.store(seq + 2, std::memory_order_release);
+}
+
+CameraState Scoreboard::read(const int camera)const{
+    const CameraLine& line = cameras[camera];
+    CameraState state;
+    unsigned int before, after;
+    do{
+        before = line.seq.load(std::memory_order_acquire);
+        state.score = line.score.load(std::memory_order_relaxed);
+        state.area = line.area.load(std::memory_order_relaxed);
+        state.vel = line.vel.load(std::memory_order_relaxed);
+        state.area_n = line.area_n.load(std::memory_order_relaxed);
+        state.frameNum = line.frameNum.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire); // the values are read before the sequence is checked again
+        after = line.seq.load(std::memory_order_relaxed);
+    } while((before & 1) || before != after);
+    state.active = line.active.load(std::memory_order_acquire);
+    return state;
+}
+
+void Scoreboard::setActive(const int camera, const bool active){
+    cameras[camera].active.store(active, std::memory_order_release);
+}
+
+bool Scoreboard::isActive(const int camera)const{
+    return cameras[camera].active.load(std::memory_order_acquire);
+}
+
+void Scoreboard::setDecodeWanted(const int camera, const bool wanted){
+    scene[camera].decodeWanted.store(wanted, std::memory_order_relaxed);
+}
+
+bool Scoreboard::decodeWanted(const int camera)const{
+    return scene[camera].decodeWanted.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,51 @@
+#ifndef __SCOREBOARD__
+#define __SCOREBOARD__
+
+#include <atomic>
+#include <memory>
+
+// Last values a camera handed to the scene, read in one piece
+struct CameraState{
+    double score = 0;
+    double area = 0;
+    double vel = 0;
+    int area_n = 0;
+    unsigned int frameNum = 0;
+    bool active = false; // producing frames
+};
+
+// State of the cameras shared between the capture tasks, the scene and the metrics server, one cache line per
+// camera and per writer: a capture task writes only the line of its camera, the scene only its own lines, so no
+// write invalidates a line another thread is writing.
+// The values of a frame are published under a sequence lock (one writer per line): a reader copies them and
+// retries if a publish was in progress, score, area and speed always come from the same frame. Nobody waits.
+class Scoreboard{
+private:
+    struct alignas(64) CameraLine{ // written by the capture task of the camera
+        std::atomic<unsigned int> seq{0}; // odd while a publish is in progress
+        std::atomic<double> score{0}, area{0}, vel{0};
+        std::atomic<int> area_n{0};
+        std::atomic<unsigned int> frameNum{0};
+        std::atomic<bool> active{false};
+    };
+    struct alignas(64) SceneLine{ // written by the scene
+        std::atomic<bool> decodeWanted{true};
+    };
+    std::unique_ptr<CameraLine[]> cameras;
+    std::unique_ptr<SceneLine[]> scene;
+    int count;
+public:
+    Scoreboard();
+    void reset(const int n); // n cameras, before the tasks start: all of them active, decode wanted
+    int size()const;
+    // Capture task of the camera
+    void publish(const int camera, const double score, const double area, const double vel, const int area_n, const unsigned int frameNum);
+    void setActive(const int camera, const bool active);
+    bool decodeWanted(const int camera)const;
+    // Scene and metrics server
+    CameraState read(const int camera)const;
+    bool isActive(const int camera)const;
+    void setDecodeWanted(const int camera, const bool wanted);
+};
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef __SIMD_DISPATCH__
+#define __SIMD_DISPATCH__
+
+#include <atomic>
+
+// The kernels are compiled for several instruction sets (GCC target attributes, no global -mavx2 needed)
+// and the best one supported by the CPU is picked at run time.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86 1
+#include <immintrin.h>
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+#define SIMD_TARGET_SSE41 __attribute__((target("sse4.1")))
+#endif
+
+typedef enum SimdLevel{
+    SIMD_SCALAR = 0,
+    SIMD_SSE41 = 1,
+    SIMD_AVX2 = 2
+}SimdLevel;
+
+// Highest level the kernels are allowed to use (lower it to compare the code paths)
+inline std::atomic<int> simdLevelCap{SIMD_AVX2};
+
+inline SimdLevel detectSimdLevel(){
+#ifdef SIMD_X86
+    static const SimdLevel detected = __builtin_cpu_supports("avx2") ? SIMD_AVX2 :
+                                      (__builtin_cpu_supports("sse4.1") ? SIMD_SSE41 : SIMD_SCALAR);
+    return detected;
+#else
+    return SIMD_SCALAR;
+#endif
+}
+
+inline SimdLevel simdLevel(){
+    int cap = simdLevelCap.load(std::memory_order_relaxed);
+    return (SimdLevel)(detectSimdLevel() < cap ? detectSimdLevel() : cap);
+}
+
+#endif
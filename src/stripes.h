@@ -0,0 +1,36 @@
+#ifndef __STRIPES__
+#define __STRIPES__
+
+#include <functional>
+#include <type_traits>
+
+// Body of a parallel loop: a reference to the caller's lambda, valid for the duration of the call.
+// Unlike a std::function it never allocates, whatever the lambda captures, so the kernels can hand
+// their stripes over at every frame.
+class StripeBody{
+private:
+    const void* callable;
+    void (*invoke)(const void* callable, const int i);
+public:
+    template<typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, StripeBody>>>
+    StripeBody(const F& f) : callable(&f), invoke([](const void* c, const int i){ (*static_cast<const F*>(c))(i); }){}
+    void operator()(const int i)const{
+        invoke(callable, i);
+    }
+};
+
+// Calls body(i) for every i in [0, count) and returns once all the calls are done.
+// An implementation may run the calls in parallel, in any order.
+typedef std::function<void(const int, const StripeBody&)> ParallelFor;
+
+inline void serialFor(const int count, const StripeBody& body){
+    for(int i = 0; i < count; i++) body(i);
+}
+
+// Rows [y0, y1) of the stripe i out of count: the stripes cover the image top to bottom
+inline void stripeRows(const int i, const int count, const int rows, int& y0, int& y1){
+    y0 = (int)((long long)rows*i/count);
+    y1 = (int)((long long)rows*(i + 1)/count);
+}
+
+#endif
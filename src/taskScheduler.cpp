@@ -0,0 +1,278 @@
+#include "taskScheduler.h"
+#include "trace.h"
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#define MIN_BACKOFF_US 50
+#define MAX_BACKOFF_US 2000
+#define IDLE_WAIT_US 1000 // longest sleep of an idle worker
+#define STRIPE_SPIN_POLLS 64 // polls of a parallelFor caller before it sleeps until the helpers are done
+
+static void pinToCpu(const int cpu){
+#ifdef _WIN32
+    if(!SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu)) std::cerr << "[SCHEDULER]: Unable to pin a worker to CPU " << cpu << std::endl;
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) std::cerr << "[SCHEDULER]: Unable to pin a worker to CPU " << cpu << std::endl;
+#else
+    std::cerr << "[SCHEDULER]: CPU affinity is not supported on this platform" << std::endl;
+#endif
+}
+
+void keepThreadOffCpus(const std::vector<int>& cpus){
+    if(cpus.empty()) return;
+#ifdef _WIN32
+    DWORD_PTR processMask, systemMask;
+    if(!GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask)) processMask = 0;
+    for(const int cpu : cpus) processMask &= ~((DWORD_PTR)1 << cpu);
+    if(processMask == 0 || !SetThreadAffinityMask(GetCurrentThread(), processMask)) std::cerr << "[SCHEDULER]: Unable to keep a thread off the analysis cores" << std::endl;
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0){
+        for(const int cpu : cpus) CPU_CLR(cpu, &set);
+        if(CPU_COUNT(&set) > 0 && pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0) return;
+    }
+    std::cerr << "[SCHEDULER]: Unable to keep a thread off the analysis cores" << std::endl;
+#else
+    std::cerr << "[SCHEDULER]: CPU affinity is not supported on this platform" << std::endl;
+#endif
+}
+
+TaskScheduler::TaskScheduler(const std::string _name){
+    name = _name;
+    liveTasks = 0;
+    stopping = false;
+    nextWorker = 0;
+    queuedHelpers = 0;
+}
+
+TaskScheduler::~TaskScheduler(){
+    stopping = true;
+    idleCv.notify_all();
+    for(auto& w : workers){
+        if(w->thread.joinable()) w->thread.join();
+        for(Task* t : w->tasks) delete t;
+    }
+    for(Task* t : spareTasks) delete t;
+    for(StripeJob* job : spareJobs) delete job;
+}
+
+void TaskScheduler::start(const int threads, const std::vector<int>& cpus, const std::vector<int>& excludedCpus){
+    // One worker per CPU when a list of cores is given
+    avoidedCpus = excludedCpus;
+    const int count = cpus.empty() ? std::max(1, threads) : cpus.size();
+    for(int i = 0; i < count; i++){
+        workers.push_back(std::make_unique<Worker>());
+        workers.back()->cpu = cpus.empty() ? -1 : cpus[i];
+    }
+    // parallelFor keeps at most one queued and one running helper per worker: room for them from the start
+    for(int i = 0; i < 2*count; i++){
+        spareTasks.push_back(new Task);
+        spareJobs.push_back(new StripeJob);
+    }
+    for(int i = 0; i < count; i++) workers[i]->thread = std::thread(&TaskScheduler::workerLoop, this, i);
+}
+
+void TaskScheduler::submit(Step step, const bool pinned){
+    Task* t = nullptr;
+    {
+        std::lock_guard lk(spareMx);
+        if(!spareTasks.empty()){
+            t = spareTasks.back();
+            spareTasks.pop_back();
+        }
+    }
+    if(t == nullptr) t = new Task;
+    t->step = std::move(step);
+    t->pinned = pinned;
+    t->backoffUs = 0;
+    t->notBefore = Clock::now();
+    liveTasks++;
+    // Round robin: the tasks start spread over the workers
+    Worker& w = *workers[nextWorker.fetch_add(1, std::memory_order_relaxed) % workers.size()];
+    {
+        std::lock_guard lk(w.mx);
+        w.tasks.push_back(t);
+    }
+    idleCv.notify_all();
+}
+
+TaskScheduler::Task* TaskScheduler::takeOwn(Worker& w, const Clock::time_point now, Clock::time_point& wakeAt){
+    std::lock_guard lk(w.mx);
+    for(auto it = w.tasks.begin(); it != w.tasks.end(); ++it){
+        if((*it)->notBefore <= now){
+            Task* t = *it;
+            w.tasks.erase(it);
+            return t;
+        }
+        if((*it)->notBefore < wakeAt) wakeAt = (*it)->notBefore;
+    }
+    return nullptr;
+}
+
+TaskScheduler::Task* TaskScheduler::steal(const int thief, const Clock::time_point now, Clock::time_point& wakeAt){
+    for(int i = 1; i < workers.size(); i++){
+        Worker& victim = *workers[(thief + i) % workers.size()];
+        std::unique_lock lk(victim.mx, std::try_to_lock); // a busy victim is skipped
+        if(!lk.owns_lock()) continue;
+        // The back of the queue holds the tasks the victim will run last
+        for(auto it = victim.tasks.rbegin(); it != victim.tasks.rend(); ++it){
+            if((*it)->pinned) continue;
+            if((*it)->notBefore <= now){
+                Task* t = *it;
+                victim.tasks.erase(std::next(it).base());
+                workers[thief]->steals++;
+                return t;
+            }
+            if((*it)->notBefore < wakeAt) wakeAt = (*it)->notBefore;
+        }
+    }
+    return nullptr;
+}
+
+void TaskScheduler::workerLoop(const int id){
+    Worker& self = *workers[id];
+    if(self.cpu >= 0) pinToCpu(self.cpu);
+    else keepThreadOffCpus(avoidedCpus);
+    TRACE_THREAD_NAME(name + " " + std::to_string(id));
+    while(!stopping){
+        Clock::time_point now = Clock::now();
+        Clock::time_point wakeAt = now + std::chrono::microseconds(IDLE_WAIT_US);
+        Task* t = takeOwn(self, now, wakeAt);
+        if(t == nullptr) t = steal(id, now, wakeAt);
+        if(t == nullptr){
+            // Nothing runnable: sleep until the first backoff expires or a task is submitted
+            std::unique_lock lk(idleMx);
+            idleCv.wait_until(lk, wakeAt);
+            continue;
+        }
+
+        TaskStatus status = t->step();
+        self.steps++;
+        if(status == TASK_FINISHED){
+            recycle(t);
+            if(--liveTasks == 0){
+                { std::lock_guard lk(idleMx); }
+                idleCv.notify_all(); // wake up wait()
+            }
+            continue;
+        }
+        if(status == TASK_BACKOFF){
+            self.backoffs++;
+            t->backoffUs = std::min(MAX_BACKOFF_US, std::max(MIN_BACKOFF_US, 2*t->backoffUs));
+            t->notBefore = Clock::now() + std::chrono::microseconds(t->backoffUs);
+        } else t->backoffUs = 0;
+        // Back at the end of the queue: the other tasks of this worker run first
+        std::lock_guard lk(self.mx);
+        self.tasks.push_back(t);
+    }
+}
+
+void TaskScheduler::recycle(Task* t){
+    t->step = nullptr; // drop what the step captured
+    std::lock_guard lk(spareMx);
+    spareTasks.push_back(t);
+}
+
+TaskScheduler::StripeJob* TaskScheduler::acquireJob(const int count, const StripeBody& body, const int users){
+    StripeJob* job = nullptr;
+    {
+        std::lock_guard lk(spareMx);
+        if(!spareJobs.empty()){
+            job = spareJobs.back();
+            spareJobs.pop_back();
+        }
+    }
+    if(job == nullptr) job = new StripeJob;
+    job->next = 0;
+    job->done = 0;
+    job->users = users;
+    job->count = count;
+    job->body = &body;
+    return job;
+}
+
+void TaskScheduler::runStripes(StripeJob* job){
+    // body is only touched while some iteration is missing: the caller is still waiting for it
+    for(int i = job->next.fetch_add(1); i < job->count; i = job->next.fetch_add(1)){
+        (*job->body)(i);
+        if(job->done.fetch_add(1, std::memory_order_acq_rel) + 1 == job->count){
+            // Under the mutex: the caller either has not checked done yet or is already waiting
+            std::lock_guard lk(job->mx);
+            job->cv.notify_one();
+        }
+    }
+}
+
+void TaskScheduler::releaseJob(StripeJob* job){
+    // A helper may start after the loop is over: the job is reused only once every helper has let it go
+    if(job->users.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+    std::lock_guard lk(spareMx);
+    spareJobs.push_back(job);
+}
+
+void TaskScheduler::parallelFor(const int count, const StripeBody& body){
+    if(count <= 1 || workers.size() <= 1){
+        serialFor(count, body);
+        return;
+    }
+    // The iterations are claimed one at a time by the caller and by helper tasks on the other workers.
+    // The caller always takes part, so the loop completes even if every other worker is busy.
+    // With a helper already queued for every worker they are all busy: a new helper would start after the loop is over
+    const int workerCount = workers.size();
+    const int helpers = std::max(0, std::min(std::min(count, workerCount) - 1, workerCount - queuedHelpers.load(std::memory_order_relaxed)));
+    StripeJob* job = acquireJob(count, body, helpers + 1);
+    queuedHelpers.fetch_add(helpers, std::memory_order_relaxed);
+    for(int h = 0; h < helpers; h++){
+        submit([this, job] { // two pointers: stored inside the std::function, no allocation
+            queuedHelpers.fetch_sub(1, std::memory_order_relaxed);
+            runStripes(job);
+            releaseJob(job);
+            return TASK_FINISHED;
+        });
+    }
+    runStripes(job);
+    // The last stripes of the helpers are usually almost over: a short spin, then sleep instead of burning the core
+    for(int i = 0; i < STRIPE_SPIN_POLLS && job->done.load(std::memory_order_acquire) < count; i++) std::this_thread::yield();
+    if(job->done.load(std::memory_order_acquire) < count){
+        std::unique_lock lk(job->mx);
+        job->cv.wait(lk, [job, count] {return job->done.load(std::memory_order_acquire) >= count;});
+    }
+    releaseJob(job);
+}
+
+void TaskScheduler::wait(){
+    {
+        std::unique_lock lk(idleMx);
+        idleCv.wait(lk, [this] {return liveTasks.load() == 0;});
+    }
+    stopping = true;
+    idleCv.notify_all();
+    for(auto& w : workers) if(w->thread.joinable()) w->thread.join();
+}
+
+int TaskScheduler::threadCount()const{
+    return workers.size();
+}
+
+std::ostream& operator <<(std::ostream& os, const TaskScheduler& scheduler){
+    unsigned long long steps = 0, backoffs = 0, steals = 0;
+    for(const auto& w : scheduler.workers){
+        steps += w->steps;
+        backoffs += w->backoffs;
+        steals += w->steals;
+    }
+    os << "[" << scheduler.name << "] " << scheduler.workers.size() << " workers, " << steps << " steps, "
+       << backoffs << " backoffs, " << steals << " steals";
+    return os;
+}
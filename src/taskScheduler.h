@@ -0,0 +1,93 @@
+#ifndef __TASK_SCHEDULER__
+#define __TASK_SCHEDULER__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "stripes.h"
+
+// What a step of a task reports to the scheduler
+typedef enum TaskStatus{
+    TASK_PROGRESS = 0, // some work was done, run the next step
+    TASK_BACKOFF = 1,  // nothing could be done now (e.g. full ring), retry a bit later
+    TASK_FINISHED = 2
+}TaskStatus;
+
+// Restrict the calling thread to the cores of the process but cpus. On Linux the threads it starts afterwards inherit it.
+void keepThreadOffCpus(const std::vector<int>& cpus);
+
+// Fixed set of worker threads running step functions instead of one thread per camera.
+// Every worker has its own queue and runs its tasks round robin; an idle worker steals a task from
+// the back of the queue of another worker. A step never waits: a task that backs off is retried
+// after a growing delay so its worker can run the other tasks meanwhile.
+class TaskScheduler{
+public:
+    typedef std::function<TaskStatus()> Step;
+private:
+    typedef std::chrono::steady_clock Clock;
+    struct Task{
+        Step step;
+        bool pinned; // never stolen, e.g. the task owns HighGUI windows
+        int backoffUs;
+        Clock::time_point notBefore;
+    };
+    // Iterations of a parallelFor, shared by the caller and its helper tasks
+    struct StripeJob{
+        std::atomic<int> next;
+        std::atomic<int> done;
+        std::atomic<int> users; // the caller and the helpers that still hold the job, the last one recycles it
+        int count;
+        const StripeBody* body;
+        std::mutex mx; // the caller sleeps on cv once its short spin is over, the last iteration wakes it
+        std::condition_variable cv;
+    };
+    struct Worker{
+        std::mutex mx;
+        std::vector<Task*> tasks; // a handful per worker: unlike a deque, a vector keeps its memory as the tasks cycle
+        std::thread thread;
+        int cpu; // core the worker is pinned to, -1 for none
+        // Written by the worker only, read after the join
+        unsigned long long steps = 0;
+        unsigned long long backoffs = 0;
+        unsigned long long steals = 0;
+    };
+    std::string name;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<int> liveTasks;
+    std::atomic<bool> stopping;
+    std::mutex idleMx;
+    std::condition_variable idleCv;
+    std::atomic<unsigned int> nextWorker; // submit() may be called by the workers too (parallelFor)
+    std::atomic<int> queuedHelpers; // helper tasks of parallelFor not started yet
+    std::vector<int> avoidedCpus; // cores the workers that are not pinned stay off
+    // Finished tasks and stripe jobs, reused: a parallelFor in the steady state does not allocate
+    std::mutex spareMx;
+    std::vector<Task*> spareTasks;
+    std::vector<StripeJob*> spareJobs;
+    void recycle(Task* t);
+    StripeJob* acquireJob(const int count, const StripeBody& body, const int users);
+    void runStripes(StripeJob* job);
+    void releaseJob(StripeJob* job);
+    void workerLoop(const int id);
+    Task* takeOwn(Worker& w, const Clock::time_point now, Clock::time_point& wakeAt);
+    Task* steal(const int thief, const Clock::time_point now, Clock::time_point& wakeAt);
+public:
+    TaskScheduler(const std::string _name);
+    ~TaskScheduler();
+    // With cpus, one worker pinned to each of them; otherwise threads workers, kept off excludedCpus
+    void start(const int threads, const std::vector<int>& cpus, const std::vector<int>& excludedCpus = {});
+    void submit(Step step, const bool pinned = false);
+    void parallelFor(const int count, const StripeBody& body); // see ParallelFor
+    void wait(); // until every task has finished, then the workers are joined
+    int threadCount()const;
+    friend std::ostream& operator <<(std::ostream& os, const TaskScheduler& scheduler);
+};
+
+#endif
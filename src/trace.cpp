@@ -0,0 +1,219 @@
+#include "trace.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+
+#define TRACE_CHUNK_EVENTS 16384
+#define TRACE_MAX_EVENTS_PER_THREAD (64*TRACE_CHUNK_EVENTS) // about 40 MB per thread, later events are dropped
+
+// Quoted JSON string. The track and thread names come from the camera names of the config file.
+static std::string jsonString(const std::string& s){
+    std::string quoted = "\"";
+    for(const char c : s){
+        if(c == '"' || c == '\\'){
+            quoted += '\\';
+            quoted += c;
+        } else if(c == '\n') quoted += "\\n";
+        else if(c == '\t') quoted += "\\t";
+        else if((unsigned char)c < 0x20){
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", c);
+            quoted += code;
+        } else quoted += c;
+    }
+    return quoted + "\"";
+}
+
+// ---- LatencyHistogram ----
+
+LatencyHistogram::LatencyHistogram(){
+    total = 0;
+    maxValue = 0;
+}
+
+int LatencyHistogram::bucketOf(const uint64_t ns){
+    if(ns < SUB_BUCKETS) return ns;
+    const int e = 63 - __builtin_clzll(ns); // position of the highest bit, >= SUB_BUCKET_BITS
+    return (e - SUB_BUCKET_BITS + 1)*SUB_BUCKETS + ((ns >> (e - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+}
+
+uint64_t LatencyHistogram::bucketTop(const int bucket){
+    if(bucket < SUB_BUCKETS) return bucket;
+    const int shift = bucket/SUB_BUCKETS - 1; // e - SUB_BUCKET_BITS
+    const uint64_t lower = (uint64_t)(SUB_BUCKETS + bucket%SUB_BUCKETS) << shift;
+    return lower + ((uint64_t)1 << shift) - 1;
+}
+
+void LatencyHistogram::record(const uint64_t ns){
+    if(counts.empty()) counts.assign((64 - SUB_BUCKET_BITS + 1)*SUB_BUCKETS, 0);
+    counts[bucketOf(ns)]++;
+    total++;
+    if(ns > maxValue) maxValue = ns;
+}
+
+uint64_t LatencyHistogram::percentile(const double p)const{
+    if(total == 0) return 0;
+    const uint64_t rank = std::max<uint64_t>(1, (uint64_t)(p*total + 0.5));
+    uint64_t seen = 0;
+    for(int b = 0; b < counts.size(); b++){
+        seen += counts[b];
+        if(seen >= rank) return std::min(bucketTop(b), maxValue);
+    }
+    return maxValue;
+}
+
+uint64_t LatencyHistogram::max()const{
+    return maxValue;
+}
+
+uint64_t LatencyHistogram::count()const{
+    return total;
+}
+
+// ---- TraceTrack ----
+
+TraceTrack::TraceTrack(const std::string& _name){
+    name = _name;
+}
+
+void TraceTrack::setName(const std::string& _name){
+    name = _name;
+}
+
+const std::string& TraceTrack::getName()const{
+    return name;
+}
+
+void TraceTrack::record(const char* stage, const uint64_t ns){
+    // A handful of stages per track: a linear search on the literal pointers is enough
+    for(auto& [key, histogram] : stages){
+        if(key == stage){
+            histogram.record(ns);
+            return;
+        }
+    }
+    stages.emplace_back(stage, LatencyHistogram());
+    stages.back().second.record(ns);
+}
+
+void TraceTrack::writeJson(std::ostream& os)const{
+    os << jsonString(name) << ": {";
+    for(int i = 0; i < stages.size(); i++){
+        const LatencyHistogram& h = stages[i].second;
+        os << (i ? ", " : "") << jsonString(stages[i].first) << ": {\"count\": " << h.count() << std::fixed << std::setprecision(3)
+           << ", \"p50Us\": " << h.percentile(0.5)/1e3 << ", \"p99Us\": " << h.percentile(0.99)/1e3 << ", \"maxUs\": " << h.max()/1e3 << "}";
+    }
+    os << "}";
+}
+
+std::ostream& operator <<(std::ostream& os, const TraceTrack& track){
+    os << "[" << track.name << "]";
+    for(const auto& [stage, h] : track.stages){
+        os << "\n    " << std::left << std::setw(12) << stage << std::right << std::fixed << std::setprecision(3)
+           << " p50 " << h.percentile(0.5)/1e6 << " ms, p99 " << h.percentile(0.99)/1e6 << " ms, max " << h.max()/1e6
+           << " ms (" << h.count() << ")";
+    }
+    return os;
+}
+
+// ---- Tracer ----
+
+struct TraceEvent{
+    const char* name;
+    const TraceTrack* track;
+    uint64_t start;
+    uint64_t duration;
+    bool instant;
+};
+
+// Events of one thread. Only the owner appends; the buffers outlive their threads and are read by dump().
+struct TraceBuffer{
+    int tid;
+    std::string threadName;
+    std::vector<std::unique_ptr<TraceEvent[]>> chunks;
+    size_t count = 0;
+    unsigned long long dropped = 0;
+    void append(const TraceEvent& e){
+        if(count >= TRACE_MAX_EVENTS_PER_THREAD){
+            dropped++;
+            return;
+        }
+        if(count % TRACE_CHUNK_EVENTS == 0) chunks.emplace_back(new TraceEvent[TRACE_CHUNK_EVENTS]);
+        chunks.back()[count % TRACE_CHUNK_EVENTS] = e;
+        count++;
+    }
+};
+
+static std::mutex registryMx; // taken once per thread, when its buffer is created, and by dump()
+static std::vector<std::unique_ptr<TraceBuffer>> registry;
+static const uint64_t originNs = Tracer::nowNs();
+
+static TraceBuffer& threadBuffer(){
+    thread_local TraceBuffer* buffer = nullptr;
+    if(buffer == nullptr){
+        std::lock_guard lk(registryMx);
+        registry.push_back(std::make_unique<TraceBuffer>());
+        buffer = registry.back().get();
+        buffer->tid = registry.size();
+        buffer->threadName = "thread " + std::to_string(buffer->tid);
+    }
+    return *buffer;
+}
+
+uint64_t Tracer::nowNs(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Tracer::event(const TraceTrack* track, const char* name, const uint64_t startNs, const uint64_t durationNs){
+    threadBuffer().append({name, track, startNs, durationNs, false});
+}
+
+void Tracer::instant(const TraceTrack* track, const char* name){
+    threadBuffer().append({name, track, nowNs(), 0, true});
+}
+
+void Tracer::setThreadName(const std::string& name){
+    threadBuffer().threadName = name;
+}
+
+bool Tracer::enabled(){
+#ifdef MULTICAMSWITCH_TRACE
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool Tracer::dump(const std::string& path, const std::vector<const TraceTrack*>& tracks){
+    std::ofstream out(path, std::ofstream::out | std::ofstream::trunc);
+    if(!out.is_open()) return false;
+    std::lock_guard lk(registryMx);
+    unsigned long long dropped = 0;
+    out << "{\"displayTimeUnit\": \"ms\",\n\"traceEvents\": [";
+    bool first = true;
+    out << std::fixed << std::setprecision(3);
+    for(const auto& buffer : registry){
+        out << (first ? "\n" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->tid
+            << ", \"args\": {\"name\": " << jsonString(buffer->threadName) << "}}";
+        first = false;
+        for(size_t i = 0; i < buffer->count; i++){
+            const TraceEvent& e = buffer->chunks[i/TRACE_CHUNK_EVENTS][i%TRACE_CHUNK_EVENTS];
+            const std::string category = jsonString(e.track ? e.track->getName() : "");
+            out << ",\n{\"name\": " << jsonString(e.name) << ", \"cat\": " << category << ", \"ph\": \"" << (e.instant ? "i" : "X")
+                << "\", \"pid\": 1, \"tid\": " << buffer->tid << ", \"ts\": " << (e.start - originNs)/1e3;
+            if(e.instant) out << ", \"s\": \"t\"";
+            else out << ", \"dur\": " << e.duration/1e3;
+            out << ", \"args\": {\"track\": " << category << "}}";
+        }
+        dropped += buffer->dropped;
+    }
+    out << "\n],\n\"droppedEvents\": " << dropped << ",\n\"stageLatency\": {";
+    for(int i = 0; i < tracks.size(); i++){
+        out << (i ? ",\n" : "\n");
+        tracks[i]->writeJson(out);
+    }
+    out << "\n}}\n";
+    return true;
+}
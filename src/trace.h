@@ -0,0 +1,91 @@
+#ifndef __TRACE__
+#define __TRACE__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Scoped trace events, enabled at compile time with MULTICAMSWITCH_TRACE (cmake -DMULTICAMSWITCH_TRACE=ON).
+// Without it TRACE_SCOPE, TRACE_INSTANT and TRACE_THREAD_NAME expand to nothing.
+//
+// Every thread appends its events to its own buffer (no locks, no shared cache lines); the buffers are
+// dumped as Chrome trace JSON (chrome://tracing, ui.perfetto.dev) once the threads are done.
+// Each scope also records its duration in the latency histogram of its track (a camera, the scene, an encoder).
+
+// Latency histogram with logarithmic buckets: 16 linear sub-buckets for every power of two of nanoseconds,
+// so every percentile is within ~6% of the real value (HdrHistogram style).
+class LatencyHistogram{
+private:
+    static const int SUB_BUCKET_BITS = 4;
+    static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    std::vector<uint64_t> counts; // allocated by the first record()
+    uint64_t total;
+    uint64_t maxValue;
+    static int bucketOf(const uint64_t ns);
+    static uint64_t bucketTop(const int bucket);
+public:
+    LatencyHistogram();
+    void record(const uint64_t ns);
+    uint64_t percentile(const double p)const; // ns
+    uint64_t max()const;
+    uint64_t count()const;
+};
+
+// Stage latencies of one component. Only one thread at a time records into a track: the task of a camera,
+// the scene thread, the thread of an encoder.
+class TraceTrack{
+private:
+    std::string name;
+    std::vector<std::pair<const char*, LatencyHistogram>> stages; // by stage name (string literals)
+public:
+    TraceTrack(const std::string& _name = "");
+    void setName(const std::string& _name);
+    const std::string& getName()const;
+    void record(const char* stage, const uint64_t ns);
+    void writeJson(std::ostream& os)const;
+    friend std::ostream& operator <<(std::ostream& os, const TraceTrack& track);
+};
+
+class Tracer{
+public:
+    static uint64_t nowNs(); // steady clock
+    static void event(const TraceTrack* track, const char* name, const uint64_t startNs, const uint64_t durationNs);
+    static void instant(const TraceTrack* track, const char* name);
+    static void setThreadName(const std::string& name);
+    static bool enabled();
+    // Chrome trace JSON plus the histograms of the tracks. Call it when the traced threads are done.
+    static bool dump(const std::string& path, const std::vector<const TraceTrack*>& tracks);
+};
+
+class TraceScope{
+private:
+    TraceTrack* track;
+    const char* name;
+    uint64_t start;
+public:
+    TraceScope(TraceTrack* _track, const char* _name) : track(_track), name(_name), start(Tracer::nowNs()){}
+    ~TraceScope(){
+        const uint64_t duration = Tracer::nowNs() - start;
+        if(track) track->record(name, duration);
+        Tracer::event(track, name, start, duration);
+    }
+};
+
+#ifdef MULTICAMSWITCH_TRACE
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(track, name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(track, name)
+#define TRACE_INSTANT(track, name) Tracer::instant(track, name)
+#define TRACE_THREAD_NAME(name) Tracer::setThreadName(name)
+#else
+#define TRACE_SCOPE(track, name) do{}while(0)
+#define TRACE_INSTANT(track, name) do{}while(0)
+#define TRACE_THREAD_NAME(name) do{}while(0)
+#endif
+
+#endif